@@ -0,0 +1,185 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Linear allocator for temporaries. Allocating bumps a pointer, memory is
+// given back all at once with arena_reset or back to a mark with
+// arena_rewind. Blocks come from malloc only while the arena is still
+// growing: a reset folds everything into one block big enough for the whole
+// run, and a block dropped by a rewind is kept around for the next overflow.
+//
+//   struct arena_mark mark = arena_mark(scratch);
+//   uint32_t *remap = arena_alloc(scratch, sizeof(uint32_t) * count);
+//   ...
+//   arena_rewind(scratch, mark);
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_DEFAULT_BLOCK_SIZE (1024 * 1024)
+
+struct arena_block {
+  struct arena_block *previous;
+  size_t size, used;
+};
+
+struct arena {
+  struct arena_block *block; // newest block, allocations come from it
+  struct arena_block *spare; // dropped by a rewind, reused before malloc
+  size_t block_size;         // minimum size of a new block
+
+  // Counters, never reset
+  size_t allocations; // arena_alloc calls
+  size_t heap_blocks; // blocks that had to be malloced
+  size_t used, peak;  // bytes handed out right now / at most
+};
+
+struct arena_mark {
+  struct arena_block *block;
+  size_t block_used, used;
+};
+
+static size_t arena_align(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+}
+
+static unsigned char *arena_block_data(struct arena_block *block) {
+  return (unsigned char *) block + arena_align(sizeof(struct arena_block));
+}
+
+void init_arena(struct arena *arena, size_t block_size) {
+  memset(arena, 0, sizeof(*arena));
+  arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+}
+
+static struct arena_block *arena_new_block(struct arena *arena, size_t size) {
+  if (arena->spare && arena->spare->size >= size) {
+    struct arena_block *block = arena->spare;
+    arena->spare = NULL;
+    return block;
+  }
+
+  struct arena_block *block =
+      malloc(arena_align(sizeof(struct arena_block)) + size);
+  if (!block)
+    return NULL;
+
+  block->size = size;
+  arena->heap_blocks++;
+  return block;
+}
+
+// 16 byte aligned, NULL only if malloc fails
+void *arena_alloc(struct arena *arena, size_t size) {
+  size = arena_align(size ? size : 1);
+  struct arena_block *block = arena->block;
+
+  if (!block || block->used + size > block->size) {
+    // Grow geometrically so a big load needs few blocks
+    size_t block_size = arena->block_size;
+    if (block && block->size * 2 > block_size)
+      block_size = block->size * 2;
+    if (size > block_size)
+      block_size = size;
+
+    struct arena_block *next = arena_new_block(arena, block_size);
+    if (!next)
+      return NULL;
+
+    next->previous = block;
+    next->used = 0;
+    arena->block = block = next;
+  }
+
+  void *data = arena_block_data(block) + block->used;
+  block->used += size;
+
+  arena->allocations++;
+  arena->used += size;
+  if (arena->used > arena->peak)
+    arena->peak = arena->used;
+  return data;
+}
+
+void *arena_calloc(struct arena *arena, size_t count, size_t size) {
+  void *data = arena_alloc(arena, count * size);
+  if (data)
+    memset(data, 0, count * size);
+  return data;
+}
+
+struct arena_mark arena_mark(const struct arena *arena) {
+  struct arena_mark mark = {
+      arena->block,
+      arena->block ? arena->block->used : 0,
+      arena->used,
+  };
+  return mark;
+}
+
+// Frees everything allocated after the mark was taken
+void arena_rewind(struct arena *arena, struct arena_mark mark) {
+  while (arena->block && arena->block != mark.block) {
+    struct arena_block *block = arena->block;
+    arena->block = block->previous;
+
+    // Keep the biggest block for the next time the arena overflows
+    if (!arena->spare || arena->spare->size < block->size) {
+      free(arena->spare);
+      arena->spare = block;
+    } else {
+      free(block);
+    }
+  }
+
+  if (arena->block)
+    arena->block->used = mark.block_used;
+  arena->used = mark.used;
+}
+
+// Frees everything. If the arena had to grow, its blocks are merged into one
+// so the same amount of work fits without touching the heap next time.
+void arena_reset(struct arena *arena) {
+  struct arena_block *block = arena->block;
+  if (block && block->previous) {
+    size_t total = 0;
+    while (block) {
+      struct arena_block *previous = block->previous;
+      total += block->size;
+      free(block);
+      block = previous;
+    }
+    free(arena->spare);
+    arena->spare = NULL;
+
+    arena->block = arena_new_block(arena, total);
+    if (arena->block)
+      arena->block->previous = NULL;
+  }
+
+  if (arena->block)
+    arena->block->used = 0;
+  arena->used = 0;
+}
+
+void print_arena_stats(const struct arena *arena, const char *name) {
+  printf(
+      "%s: %zu allocations, %.1f KiB peak, %zu heap blocks\n",
+      name,
+      arena->allocations,
+      (double) arena->peak / 1024.0,
+      arena->heap_blocks
+  );
+}
+
+void free_arena(struct arena *arena) {
+  struct arena_block *block = arena->block;
+  while (block) {
+    struct arena_block *previous = block->previous;
+    free(block);
+    block = previous;
+  }
+  free(arena->spare);
+  memset(arena, 0, sizeof(*arena));
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <glad/glad.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mat4.h"
+
+// Projection matrix & viewport that follow the window. The projection is
+// only rebuilt when SDL reports a new size, with the aspect ratio of the
+// drawable (which is bigger than the window on HiDPI screens).
+//
+// With reverse_z depth goes from 1 at the near plane to 0 at the far one.
+// Floating point keeps most of its precision close to 0, which is where the
+// far away geometry ends up, so z-fighting in the distance mostly goes away.
+// A fixed point depth buffer, like the one of the default framebuffer, is
+// exactly as precise either way round, so with reverse Z the scene is drawn
+// into the camera's own framebuffer with a 32 bit float depth buffer and
+// copied to the window afterwards.
+//
+// It needs glClipControl (GL 4.5 or ARB_clip_control), which glad doesn't
+// load for a 4.1 context, so it is looked up by hand. Without it the camera
+// quietly falls back to the usual -1..1 depth and draws straight to the
+// window.
+//
+//   struct camera camera;
+//   init_perspective_camera(&camera, window, 1.29f, 1.0f, 101.0f, 1);
+//   ...
+//   if (camera_handle_event(&camera, window, &event))
+//     setup_matrix(shader, "projection", camera.projection);
+//   begin_camera_frame(&camera);
+//   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+//   ...
+//   end_camera_frame(&camera);
+//   SDL_GL_SwapWindow(window);
+
+// Not in the 4.1 headers
+#ifndef GL_ZERO_TO_ONE
+  #define GL_ZERO_TO_ONE 0x935F
+#endif
+#ifndef GL_NEGATIVE_ONE_TO_ONE
+  #define GL_NEGATIVE_ONE_TO_ONE 0x935E
+#endif
+
+typedef void (*camera_clip_control_proc)(GLenum origin, GLenum depth);
+
+enum camera_type {
+  CAMERA_PERSPECTIVE,
+  CAMERA_ORTHOGRAPHIC,
+};
+
+struct camera {
+  enum camera_type type;
+  float fov_y;        // radians, perspective only
+  float ortho_height; // view space units visible vertically, orthographic
+  float z_near, z_far;
+  int reverse_z; // whether reverse Z is actually in use
+
+  // Where the scene is drawn with reverse Z, 0 (the window) otherwise
+  GLuint fbo, color_buffer, depth_buffer;
+
+  int window_width, window_height; // in screen coordinates
+  int width, height;               // drawable size in pixels
+  float aspect;
+
+  float projection[16];
+};
+
+// Switches the depth range to 0..1 and flips the depth test, returns 0 if
+// the driver can't do it
+static int camera_enable_reverse_z(void) {
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  if (major * 10 + minor < 45
+      && !SDL_GL_ExtensionSupported("GL_ARB_clip_control"))
+    return 0;
+
+  camera_clip_control_proc clip_control =
+      (camera_clip_control_proc) SDL_GL_GetProcAddress("glClipControl");
+  if (!clip_control)
+    return 0;
+
+  clip_control(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+  glClearDepth(0.0);
+  glDepthFunc(GL_GREATER);
+  return 1;
+}
+
+// The opposite, for when the float depth target can't be made
+static void camera_disable_reverse_z(struct camera *camera) {
+  camera_clip_control_proc clip_control =
+      (camera_clip_control_proc) SDL_GL_GetProcAddress("glClipControl");
+  clip_control(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+  glClearDepth(1.0);
+  glDepthFunc(GL_LESS);
+
+  glDeleteFramebuffers(1, &camera->fbo);
+  glDeleteRenderbuffers(1, &camera->color_buffer);
+  glDeleteRenderbuffers(1, &camera->depth_buffer);
+  camera->fbo = camera->color_buffer = camera->depth_buffer = 0;
+  camera->reverse_z = 0;
+}
+
+// (Re)allocates the reverse Z framebuffer at the drawable size, returns 0 if
+// the driver won't render to it
+static int camera_resize_depth_target(struct camera *camera) {
+  if (!camera->fbo) {
+    glGenFramebuffers(1, &camera->fbo);
+    glGenRenderbuffers(1, &camera->color_buffer);
+    glGenRenderbuffers(1, &camera->depth_buffer);
+  }
+
+  glBindRenderbuffer(GL_RENDERBUFFER, camera->color_buffer);
+  glRenderbufferStorage(
+      GL_RENDERBUFFER,
+      GL_RGBA8,
+      camera->width,
+      camera->height
+  );
+  glBindRenderbuffer(GL_RENDERBUFFER, camera->depth_buffer);
+  glRenderbufferStorage(
+      GL_RENDERBUFFER,
+      GL_DEPTH_COMPONENT32F,
+      camera->width,
+      camera->height
+  );
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, camera->fbo);
+  glFramebufferRenderbuffer(
+      GL_FRAMEBUFFER,
+      GL_COLOR_ATTACHMENT0,
+      GL_RENDERBUFFER,
+      camera->color_buffer
+  );
+  glFramebufferRenderbuffer(
+      GL_FRAMEBUFFER,
+      GL_DEPTH_ATTACHMENT,
+      GL_RENDERBUFFER,
+      camera->depth_buffer
+  );
+  int complete =
+      glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return complete;
+}
+
+static void camera_perspective(struct camera *camera) {
+  float *m = camera->projection;
+  float f = 1.0f / tanf(camera->fov_y * 0.5f);
+  float n = camera->z_near, range = camera->z_far - camera->z_near;
+
+  mat4_diagonal(m, f / camera->aspect, f, 0.0f, 0.0f);
+  m[11] = -1.0f;
+  if (camera->reverse_z) {
+    // near -> 1, far -> 0
+    m[10] = n / range;
+    m[14] = n * camera->z_far / range;
+  } else {
+    m[10] = -(camera->z_far + n) / range;
+    m[14] = -2.0f * camera->z_far * n / range;
+  }
+}
+
+static void camera_orthographic(struct camera *camera) {
+  float *m = camera->projection;
+  float half_height = camera->ortho_height * 0.5f;
+  float half_width = half_height * camera->aspect;
+  float range = camera->z_far - camera->z_near;
+
+  mat4_diagonal(m, 1.0f / half_width, 1.0f / half_height, 0.0f, 1.0f);
+  if (camera->reverse_z) {
+    m[10] = 1.0f / range;
+    m[14] = camera->z_far / range;
+  } else {
+    m[10] = -2.0f / range;
+    m[14] = -(camera->z_far + camera->z_near) / range;
+  }
+}
+
+// Picks up the current size of the window, sets the viewport and rebuilds
+// the projection
+void resize_camera(struct camera *camera, SDL_Window *window) {
+  SDL_GetWindowSize(window, &camera->window_width, &camera->window_height);
+  SDL_GL_GetDrawableSize(window, &camera->width, &camera->height);
+  if (camera->width < 1)
+    camera->width = 1;
+  if (camera->height < 1)
+    camera->height = 1;
+
+  glViewport(0, 0, camera->width, camera->height);
+  camera->aspect = (float) camera->width / (float) camera->height;
+
+  if (camera->reverse_z && !camera_resize_depth_target(camera)) {
+    printf("Can't render to a float depth buffer, reverse Z is off\n");
+    camera_disable_reverse_z(camera);
+  }
+
+  if (camera->type == CAMERA_PERSPECTIVE)
+    camera_perspective(camera);
+  else
+    camera_orthographic(camera);
+}
+
+static void init_camera(
+    struct camera *camera,
+    SDL_Window *window,
+    enum camera_type type,
+    float z_near,
+    float z_far,
+    int reverse_z
+) {
+  camera->type = type;
+  camera->z_near = z_near;
+  camera->z_far = z_far;
+  camera->reverse_z = reverse_z && camera_enable_reverse_z();
+  resize_camera(camera, window);
+}
+
+// fov_y in radians
+void init_perspective_camera(
+    struct camera *camera,
+    SDL_Window *window,
+    float fov_y,
+    float z_near,
+    float z_far,
+    int reverse_z
+) {
+  memset(camera, 0, sizeof(*camera));
+  camera->fov_y = fov_y;
+  init_camera(camera, window, CAMERA_PERSPECTIVE, z_near, z_far, reverse_z);
+}
+
+// ortho_height is how much of the view space is visible vertically
+void init_orthographic_camera(
+    struct camera *camera,
+    SDL_Window *window,
+    float ortho_height,
+    float z_near,
+    float z_far,
+    int reverse_z
+) {
+  memset(camera, 0, sizeof(*camera));
+  camera->ortho_height = ortho_height;
+  init_camera(camera, window, CAMERA_ORTHOGRAPHIC, z_near, z_far, reverse_z);
+}
+
+// Call for every event, returns 1 if the window changed size (and with it
+// the projection and viewport)
+int camera_handle_event(
+    struct camera *camera,
+    SDL_Window *window,
+    const SDL_Event *event
+) {
+  if (event->type != SDL_WINDOWEVENT
+      || event->window.event != SDL_WINDOWEVENT_SIZE_CHANGED)
+    return 0;
+
+  resize_camera(camera, window);
+  return 1;
+}
+
+// Binds where the scene is drawn, call before clearing
+void begin_camera_frame(const struct camera *camera) {
+  glBindFramebuffer(GL_FRAMEBUFFER, camera->fbo);
+}
+
+// Copies what was drawn to the window if it wasn't drawn there already, call
+// before swapping
+void end_camera_frame(const struct camera *camera) {
+  if (!camera->fbo)
+    return;
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, camera->fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(
+      0,
+      0,
+      camera->width,
+      camera->height,
+      0,
+      0,
+      camera->width,
+      camera->height,
+      GL_COLOR_BUFFER_BIT,
+      GL_NEAREST
+  );
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void free_camera(struct camera *camera) {
+  glDeleteFramebuffers(1, &camera->fbo);
+  glDeleteRenderbuffers(1, &camera->color_buffer);
+  glDeleteRenderbuffers(1, &camera->depth_buffer);
+  memset(camera, 0, sizeof(*camera));
+}
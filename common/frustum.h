@@ -0,0 +1,304 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mat4.h"
+
+// View frustum culling. The six planes come out of a clip matrix (Gribb &
+// Hartmann), in whatever space the last matrix of the product maps from:
+// projection * view gives world space planes, projection * view * model
+// gives planes in model space, so object bounds can be tested without
+// transforming them. With a 0..1 depth range (reverse Z in camera.h) the far
+// plane comes out further away than it is, which only means less gets culled.
+//
+// The tests take bounds as a structure of arrays and check 4 of them per
+// SSE2/NEON operation. The cull functions write a compacted list of the
+// indices that survived and return how many there are.
+
+struct frustum {
+  float planes[6][4]; // normalized, inside is positive
+};
+
+void extract_frustum(struct frustum *frustum, const float *clip) {
+  for (int p = 0; p < 6; p++) {
+    int row = p / 2;
+    float sign = p % 2 ? -1.0f : 1.0f;
+    float *plane = frustum->planes[p];
+    for (int k = 0; k < 4; k++)
+      plane[k] = clip[k * 4 + 3] + sign * clip[k * 4 + row];
+
+    float length =
+        sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+    if (length > 0.0f) {
+      for (int k = 0; k < 4; k++)
+        plane[k] /= length;
+    }
+  }
+}
+
+// Planes in the space `model` maps from, model may be NULL for world space
+void frustum_from_matrices(
+    struct frustum *frustum,
+    const float *model,
+    const float *view,
+    const float *projection
+) {
+  float clip[16];
+  mat4_multiply(clip, projection, view);
+  if (model)
+    mat4_multiply(clip, clip, model);
+  extract_frustum(frustum, clip);
+}
+
+// Bit k is set if sphere k (of 4) touches the frustum
+int frustum_test_spheres4(
+    const struct frustum *frustum,
+    const float *x,
+    const float *y,
+    const float *z,
+    const float *radius
+) {
+#if defined(MAT4_SSE)
+  __m128 cx = _mm_loadu_ps(x), cy = _mm_loadu_ps(y), cz = _mm_loadu_ps(z);
+  __m128 r = _mm_loadu_ps(radius);
+  __m128 zero = _mm_setzero_ps();
+  __m128 culled = zero;
+
+  for (int p = 0; p < 6; p++) {
+    const float *plane = frustum->planes[p];
+    __m128 d = _mm_add_ps(
+        _mm_add_ps(
+            _mm_mul_ps(_mm_set1_ps(plane[0]), cx),
+            _mm_mul_ps(_mm_set1_ps(plane[1]), cy)
+        ),
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[2]), cz), _mm_set1_ps(plane[3]))
+    );
+    culled = _mm_or_ps(culled, _mm_cmplt_ps(_mm_add_ps(d, r), zero));
+  }
+  return ~_mm_movemask_ps(culled) & 0xf;
+#elif defined(MAT4_NEON)
+  float32x4_t cx = vld1q_f32(x), cy = vld1q_f32(y), cz = vld1q_f32(z);
+  float32x4_t r = vld1q_f32(radius);
+  float32x4_t zero = vdupq_n_f32(0.0f);
+  uint32x4_t culled = vdupq_n_u32(0);
+
+  for (int p = 0; p < 6; p++) {
+    const float *plane = frustum->planes[p];
+    float32x4_t d = vaddq_f32(vdupq_n_f32(plane[3]), r);
+    d = vmlaq_n_f32(d, cx, plane[0]);
+    d = vmlaq_n_f32(d, cy, plane[1]);
+    d = vmlaq_n_f32(d, cz, plane[2]);
+    culled = vorrq_u32(culled, vcltq_f32(d, zero));
+  }
+
+  uint32_t lanes[4];
+  vst1q_u32(lanes, culled);
+  return !lanes[0] | !lanes[1] << 1 | !lanes[2] << 2 | !lanes[3] << 3;
+#else
+  int visible = 0;
+  for (int k = 0; k < 4; k++) {
+    int culled = 0;
+    for (int p = 0; p < 6; p++) {
+      const float *plane = frustum->planes[p];
+      float d = plane[0] * x[k] + plane[1] * y[k] + plane[2] * z[k] + plane[3];
+      culled |= d + radius[k] < 0.0f;
+    }
+    visible |= !culled << k;
+  }
+  return visible;
+#endif
+}
+
+// Same for 4 boxes given by their centers and half extents. Against one
+// plane a box reaches as far as a sphere of radius |normal| . extent.
+int frustum_test_boxes4(
+    const struct frustum *frustum,
+    const float *center_x,
+    const float *center_y,
+    const float *center_z,
+    const float *extent_x,
+    const float *extent_y,
+    const float *extent_z
+) {
+#if defined(MAT4_SSE)
+  __m128 cx = _mm_loadu_ps(center_x), cy = _mm_loadu_ps(center_y),
+         cz = _mm_loadu_ps(center_z);
+  __m128 ex = _mm_loadu_ps(extent_x), ey = _mm_loadu_ps(extent_y),
+         ez = _mm_loadu_ps(extent_z);
+  __m128 zero = _mm_setzero_ps();
+  __m128 culled = zero;
+
+  for (int p = 0; p < 6; p++) {
+    const float *plane = frustum->planes[p];
+    __m128 d = _mm_add_ps(
+        _mm_add_ps(
+            _mm_mul_ps(_mm_set1_ps(plane[0]), cx),
+            _mm_mul_ps(_mm_set1_ps(plane[1]), cy)
+        ),
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[2]), cz), _mm_set1_ps(plane[3]))
+    );
+    __m128 reach = _mm_add_ps(
+        _mm_add_ps(
+            _mm_mul_ps(_mm_set1_ps(fabsf(plane[0])), ex),
+            _mm_mul_ps(_mm_set1_ps(fabsf(plane[1])), ey)
+        ),
+        _mm_mul_ps(_mm_set1_ps(fabsf(plane[2])), ez)
+    );
+    culled = _mm_or_ps(culled, _mm_cmplt_ps(_mm_add_ps(d, reach), zero));
+  }
+  return ~_mm_movemask_ps(culled) & 0xf;
+#elif defined(MAT4_NEON)
+  float32x4_t cx = vld1q_f32(center_x), cy = vld1q_f32(center_y),
+              cz = vld1q_f32(center_z);
+  float32x4_t ex = vld1q_f32(extent_x), ey = vld1q_f32(extent_y),
+              ez = vld1q_f32(extent_z);
+  float32x4_t zero = vdupq_n_f32(0.0f);
+  uint32x4_t culled = vdupq_n_u32(0);
+
+  for (int p = 0; p < 6; p++) {
+    const float *plane = frustum->planes[p];
+    float32x4_t d = vdupq_n_f32(plane[3]);
+    d = vmlaq_n_f32(d, cx, plane[0]);
+    d = vmlaq_n_f32(d, cy, plane[1]);
+    d = vmlaq_n_f32(d, cz, plane[2]);
+    d = vmlaq_n_f32(d, ex, fabsf(plane[0]));
+    d = vmlaq_n_f32(d, ey, fabsf(plane[1]));
+    d = vmlaq_n_f32(d, ez, fabsf(plane[2]));
+    culled = vorrq_u32(culled, vcltq_f32(d, zero));
+  }
+
+  uint32_t lanes[4];
+  vst1q_u32(lanes, culled);
+  return !lanes[0] | !lanes[1] << 1 | !lanes[2] << 2 | !lanes[3] << 3;
+#else
+  int visible = 0;
+  for (int k = 0; k < 4; k++) {
+    int culled = 0;
+    for (int p = 0; p < 6; p++) {
+      const float *plane = frustum->planes[p];
+      float d = plane[0] * center_x[k] + plane[1] * center_y[k]
+              + plane[2] * center_z[k] + plane[3];
+      float reach = fabsf(plane[0]) * extent_x[k]
+                  + fabsf(plane[1]) * extent_y[k]
+                  + fabsf(plane[2]) * extent_z[k];
+      culled |= d + reach < 0.0f;
+    }
+    visible |= !culled << k;
+  }
+  return visible;
+#endif
+}
+
+// Appends the indices of the set bits of a 4 lane mask to visible without
+// branching. All 4 slots get written, the return value says how many count.
+static size_t frustum_compact4(int mask, uint32_t first, uint32_t *visible) {
+  size_t count = 0;
+  for (uint32_t k = 0; k < 4; k++) {
+    visible[count] = first + k;
+    count += (mask >> k) & 1;
+  }
+  return count;
+}
+
+// Writes the indices of the spheres that touch the frustum to visible (room
+// for count entries) and returns how many there are
+size_t frustum_cull_spheres(
+    const struct frustum *frustum,
+    const float *x,
+    const float *y,
+    const float *z,
+    const float *radius,
+    size_t count,
+    uint32_t *visible
+) {
+  size_t visible_count = 0, i = 0;
+  for (; i + 4 <= count; i += 4) {
+    int mask = frustum_test_spheres4(frustum, x + i, y + i, z + i, radius + i);
+    visible_count +=
+        frustum_compact4(mask, (uint32_t) i, visible + visible_count);
+  }
+
+  // The last few go through a padded copy
+  if (i < count) {
+    float tail[4][4] = {{0}};
+    const float *arrays[4] = {x, y, z, radius};
+    for (int a = 0; a < 4; a++) {
+      for (size_t k = 0; i + k < count; k++)
+        tail[a][k] = arrays[a][i + k];
+    }
+    int mask = frustum_test_spheres4(
+        frustum,
+        tail[0],
+        tail[1],
+        tail[2],
+        tail[3]
+    );
+    for (size_t k = 0; i + k < count; k++) {
+      if (mask & (1 << k))
+        visible[visible_count++] = (uint32_t) (i + k);
+    }
+  }
+
+  return visible_count;
+}
+
+// Same for boxes given by centers and half extents
+size_t frustum_cull_boxes(
+    const struct frustum *frustum,
+    const float *center_x,
+    const float *center_y,
+    const float *center_z,
+    const float *extent_x,
+    const float *extent_y,
+    const float *extent_z,
+    size_t count,
+    uint32_t *visible
+) {
+  size_t visible_count = 0, i = 0;
+  for (; i + 4 <= count; i += 4) {
+    int mask = frustum_test_boxes4(
+        frustum,
+        center_x + i,
+        center_y + i,
+        center_z + i,
+        extent_x + i,
+        extent_y + i,
+        extent_z + i
+    );
+    visible_count +=
+        frustum_compact4(mask, (uint32_t) i, visible + visible_count);
+  }
+
+  if (i < count) {
+    float tail[6][4] = {{0}};
+    const float *arrays[6] = {
+        center_x,
+        center_y,
+        center_z,
+        extent_x,
+        extent_y,
+        extent_z,
+    };
+    for (int a = 0; a < 6; a++) {
+      for (size_t k = 0; i + k < count; k++)
+        tail[a][k] = arrays[a][i + k];
+    }
+    int mask = frustum_test_boxes4(
+        frustum,
+        tail[0],
+        tail[1],
+        tail[2],
+        tail[3],
+        tail[4],
+        tail[5]
+    );
+    for (size_t k = 0; i + k < count; k++) {
+      if (mask & (1 << k))
+        visible[visible_count++] = (uint32_t) (i + k);
+    }
+  }
+
+  return visible_count;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tiny fork/join pool for data parallel loops. The workers sleep between
+// jobs; job_pool_for splits [0, count) into batches, the calling thread
+// works on batches too and returns once every batch is done.
+
+typedef void (*job_function)(void *data, size_t begin, size_t end);
+
+struct job_pool {
+  SDL_Thread **threads;
+  int thread_count;
+
+  SDL_mutex *mutex;
+  SDL_cond *start, *finished;
+  unsigned int generation; // bumped for every job
+  int busy_workers;
+  int quit;
+
+  // The current job
+  job_function function;
+  void *data;
+  size_t count, batch;
+  SDL_atomic_t next_batch;
+};
+
+static void job_pool_run_batches(struct job_pool *pool) {
+  for (;;) {
+    size_t batch = (size_t) SDL_AtomicAdd(&pool->next_batch, 1);
+    size_t begin = batch * pool->batch;
+    if (begin >= pool->count)
+      break;
+
+    size_t end = begin + pool->batch;
+    pool->function(pool->data, begin, end < pool->count ? end : pool->count);
+  }
+}
+
+static int job_pool_worker(void *data) {
+  struct job_pool *pool = data;
+  unsigned int seen = 0;
+
+  SDL_LockMutex(pool->mutex);
+  for (;;) {
+    while (pool->generation == seen && !pool->quit)
+      SDL_CondWait(pool->start, pool->mutex);
+    if (pool->quit)
+      break;
+
+    seen = pool->generation;
+    SDL_UnlockMutex(pool->mutex);
+
+    job_pool_run_batches(pool);
+
+    SDL_LockMutex(pool->mutex);
+    if (--pool->busy_workers == 0)
+      SDL_CondSignal(pool->finished);
+  }
+  SDL_UnlockMutex(pool->mutex);
+
+  return 0;
+}
+
+// thread_count <= 0 picks one worker per core, minus the calling thread
+void init_job_pool(struct job_pool *pool, int thread_count) {
+  memset(pool, 0, sizeof(*pool));
+
+  if (thread_count <= 0)
+    thread_count = SDL_GetCPUCount() - 1;
+
+  pool->mutex = SDL_CreateMutex();
+  pool->start = SDL_CreateCond();
+  pool->finished = SDL_CreateCond();
+  pool->threads = malloc(sizeof(SDL_Thread *) * (thread_count + 1));
+
+  for (int i = 0; i < thread_count; i++) {
+    SDL_Thread *thread = SDL_CreateThread(job_pool_worker, "job pool", pool);
+    if (!thread)
+      break;
+    pool->threads[pool->thread_count++] = thread;
+  }
+}
+
+// Runs function over [0, count) in batches of `batch` items and waits for it
+void job_pool_for(
+    struct job_pool *pool,
+    size_t count,
+    size_t batch,
+    job_function function,
+    void *data
+) {
+  if (batch == 0)
+    batch = 1;
+
+  // Not worth waking anybody up for a single batch
+  if (pool->thread_count == 0 || count <= batch) {
+    if (count)
+      function(data, 0, count);
+    return;
+  }
+
+  SDL_LockMutex(pool->mutex);
+  pool->function = function;
+  pool->data = data;
+  pool->count = count;
+  pool->batch = batch;
+  SDL_AtomicSet(&pool->next_batch, 0);
+  pool->busy_workers = pool->thread_count;
+  pool->generation++;
+  SDL_CondBroadcast(pool->start);
+  SDL_UnlockMutex(pool->mutex);
+
+  job_pool_run_batches(pool);
+
+  SDL_LockMutex(pool->mutex);
+  while (pool->busy_workers > 0)
+    SDL_CondWait(pool->finished, pool->mutex);
+  SDL_UnlockMutex(pool->mutex);
+}
+
+void destroy_job_pool(struct job_pool *pool) {
+  SDL_LockMutex(pool->mutex);
+  pool->quit = 1;
+  SDL_CondBroadcast(pool->start);
+  SDL_UnlockMutex(pool->mutex);
+
+  for (int i = 0; i < pool->thread_count; i++)
+    SDL_WaitThread(pool->threads[i], NULL);
+
+  free(pool->threads);
+  SDL_DestroyCond(pool->start);
+  SDL_DestroyCond(pool->finished);
+  SDL_DestroyMutex(pool->mutex);
+  memset(pool, 0, sizeof(*pool));
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define MAT4_SSE
+#elif defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define MAT4_NEON
+#endif
+
+// 4x4 matrix, vector and quaternion helpers. Matrices are plain float[16] in
+// column major order, the way glUniformMatrix4fv takes them with
+// transpose = GL_FALSE. A matrix times a vector is a sum of the columns
+// scaled by the vector's components, so everything is written in terms of
+// vec4 operations on whole columns: one SSE2/NEON register per column, plain
+// floats when neither is available. Pointers don't need to be aligned.
+//
+// Quaternions are float[4] in x, y, z, w order.
+
+#if defined(MAT4_SSE)
+typedef __m128 vec4;
+
+static vec4 vec4_load(const float *p) {
+  return _mm_loadu_ps(p);
+}
+
+static void vec4_store(float *p, vec4 v) {
+  _mm_storeu_ps(p, v);
+}
+
+static vec4 vec4_mul(vec4 v, float s) {
+  return _mm_mul_ps(v, _mm_set1_ps(s));
+}
+
+// acc + v * s
+static vec4 vec4_madd(vec4 acc, vec4 v, float s) {
+  return _mm_add_ps(acc, _mm_mul_ps(v, _mm_set1_ps(s)));
+}
+#elif defined(MAT4_NEON)
+typedef float32x4_t vec4;
+
+static vec4 vec4_load(const float *p) {
+  return vld1q_f32(p);
+}
+
+static void vec4_store(float *p, vec4 v) {
+  vst1q_f32(p, v);
+}
+
+static vec4 vec4_mul(vec4 v, float s) {
+  return vmulq_n_f32(v, s);
+}
+
+static vec4 vec4_madd(vec4 acc, vec4 v, float s) {
+  return vmlaq_n_f32(acc, v, s);
+}
+#else
+typedef struct {
+  float v[4];
+} vec4;
+
+static vec4 vec4_load(const float *p) {
+  vec4 r = {{p[0], p[1], p[2], p[3]}};
+  return r;
+}
+
+static void vec4_store(float *p, vec4 v) {
+  for (int i = 0; i < 4; i++)
+    p[i] = v.v[i];
+}
+
+static vec4 vec4_mul(vec4 v, float s) {
+  for (int i = 0; i < 4; i++)
+    v.v[i] *= s;
+  return v;
+}
+
+static vec4 vec4_madd(vec4 acc, vec4 v, float s) {
+  for (int i = 0; i < 4; i++)
+    acc.v[i] += v.v[i] * s;
+  return acc;
+}
+#endif
+
+void mat4_diagonal(float *m, float x, float y, float z, float w) {
+  for (int i = 0; i < 16; i++)
+    m[i] = 0.0f;
+  m[0] = x;
+  m[5] = y;
+  m[10] = z;
+  m[15] = w;
+}
+
+void mat4_identity(float *m) {
+  mat4_diagonal(m, 1.0f, 1.0f, 1.0f, 1.0f);
+}
+
+// result = a * b, result may be a or b
+void mat4_multiply(float *result, const float *a, const float *b) {
+  vec4 a0 = vec4_load(a), a1 = vec4_load(a + 4), a2 = vec4_load(a + 8),
+       a3 = vec4_load(a + 12);
+
+  vec4 columns[4];
+  for (int col = 0; col < 4; col++) {
+    const float *c = b + col * 4;
+    vec4 r = vec4_mul(a0, c[0]);
+    r = vec4_madd(r, a1, c[1]);
+    r = vec4_madd(r, a2, c[2]);
+    columns[col] = vec4_madd(r, a3, c[3]);
+  }
+
+  for (int col = 0; col < 4; col++)
+    vec4_store(result + col * 4, columns[col]);
+}
+
+// results[i] = a * matrices[i] for count matrices, results may be matrices
+void mat4_multiply_batch(
+    float *results,
+    const float *a,
+    const float *matrices,
+    size_t count
+) {
+  vec4 a0 = vec4_load(a), a1 = vec4_load(a + 4), a2 = vec4_load(a + 8),
+       a3 = vec4_load(a + 12);
+
+  for (size_t i = 0; i < count; i++) {
+    const float *b = matrices + i * 16;
+    float *result = results + i * 16;
+
+    vec4 columns[4];
+    for (int col = 0; col < 4; col++) {
+      const float *c = b + col * 4;
+      vec4 r = vec4_mul(a0, c[0]);
+      r = vec4_madd(r, a1, c[1]);
+      r = vec4_madd(r, a2, c[2]);
+      columns[col] = vec4_madd(r, a3, c[3]);
+    }
+
+    for (int col = 0; col < 4; col++)
+      vec4_store(result + col * 4, columns[col]);
+  }
+}
+
+// result = m * v for a vec4, result may be v
+void mat4_transform(float *result, const float *m, const float *v) {
+  vec4 r = vec4_mul(vec4_load(m), v[0]);
+  r = vec4_madd(r, vec4_load(m + 4), v[1]);
+  r = vec4_madd(r, vec4_load(m + 8), v[2]);
+  r = vec4_madd(r, vec4_load(m + 12), v[3]);
+  vec4_store(result, r);
+}
+
+// Transforms count xyz points (w = 1) into count vec4s, no divide by w
+void mat4_transform_points(
+    float *results,
+    const float *m,
+    const float *points,
+    size_t count
+) {
+  vec4 m0 = vec4_load(m), m1 = vec4_load(m + 4), m2 = vec4_load(m + 8),
+       m3 = vec4_load(m + 12);
+
+  for (size_t i = 0; i < count; i++) {
+    const float *p = points + i * 3;
+    vec4 r = vec4_madd(m3, m0, p[0]);
+    r = vec4_madd(r, m1, p[1]);
+    vec4_store(results + i * 4, vec4_madd(r, m2, p[2]));
+  }
+}
+
+// m = m * rotation around Y. Only two columns change, so this is a lot
+// cheaper than building the rotation and multiplying.
+void mat4_rotate_y(float *m, float angle) {
+  float c = cosf(angle), s = sinf(angle);
+  vec4 x = vec4_load(m), z = vec4_load(m + 8);
+
+  vec4_store(m, vec4_madd(vec4_mul(x, c), z, -s));
+  vec4_store(m + 8, vec4_madd(vec4_mul(x, s), z, c));
+}
+
+// Rotation of `angle` radians around any axis, counter clockwise when the
+// axis points at the viewer
+void mat4_rotation(float *m, float angle, float x, float y, float z) {
+  float length = sqrtf(x * x + y * y + z * z);
+  if (length == 0.0f) {
+    mat4_identity(m);
+    return;
+  }
+  x /= length;
+  y /= length;
+  z /= length;
+
+  float c = cosf(angle), s = sinf(angle), t = 1.0f - c;
+  float rotation[16] = {
+      t * x * x + c,
+      t * x * y + s * z,
+      t * x * z - s * y,
+      0.0f,
+      t * x * y - s * z,
+      t * y * y + c,
+      t * y * z + s * x,
+      0.0f,
+      t * x * z + s * y,
+      t * y * z - s * x,
+      t * z * z + c,
+      0.0f,
+      0.0f,
+      0.0f,
+      0.0f,
+      1.0f,
+  };
+  for (int i = 0; i < 16; i++)
+    m[i] = rotation[i];
+}
+
+// m = m * rotation
+void mat4_rotate(float *m, float angle, float x, float y, float z) {
+  float rotation[16];
+  mat4_rotation(rotation, angle, x, y, z);
+  mat4_multiply(m, m, rotation);
+}
+
+void quat_identity(float *q) {
+  q[0] = q[1] = q[2] = 0.0f;
+  q[3] = 1.0f;
+}
+
+void quat_from_axis_angle(float *q, float angle, float x, float y, float z) {
+  float length = sqrtf(x * x + y * y + z * z);
+  if (length == 0.0f) {
+    quat_identity(q);
+    return;
+  }
+
+  float s = sinf(angle * 0.5f) / length;
+  q[0] = x * s;
+  q[1] = y * s;
+  q[2] = z * s;
+  q[3] = cosf(angle * 0.5f);
+}
+
+// result = a * b, rotating by b first and then by a. result may be a or b.
+void quat_multiply(float *result, const float *a, const float *b) {
+  float x = a[3] * b[0] + a[0] * b[3] + a[1] * b[2] - a[2] * b[1];
+  float y = a[3] * b[1] - a[0] * b[2] + a[1] * b[3] + a[2] * b[0];
+  float z = a[3] * b[2] + a[0] * b[1] - a[1] * b[0] + a[2] * b[3];
+  float w = a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2];
+  result[0] = x;
+  result[1] = y;
+  result[2] = z;
+  result[3] = w;
+}
+
+void quat_normalize(float *q) {
+  float length = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  if (length == 0.0f) {
+    quat_identity(q);
+    return;
+  }
+  for (int i = 0; i < 4; i++)
+    q[i] /= length;
+}
+
+// m = translate * rotate * scale, the rotation has to be normalized
+void mat4_from_trs(
+    float *m,
+    const float *translation,
+    const float *rotation,
+    const float *scale
+) {
+  float x = rotation[0], y = rotation[1], z = rotation[2], w = rotation[3];
+  float xx = x * x, yy = y * y, zz = z * z;
+  float xy = x * y, xz = x * z, yz = y * z;
+  float wx = w * x, wy = w * y, wz = w * z;
+
+  m[0] = (1.0f - 2.0f * (yy + zz)) * scale[0];
+  m[1] = 2.0f * (xy + wz) * scale[0];
+  m[2] = 2.0f * (xz - wy) * scale[0];
+  m[3] = 0.0f;
+  m[4] = 2.0f * (xy - wz) * scale[1];
+  m[5] = (1.0f - 2.0f * (xx + zz)) * scale[1];
+  m[6] = 2.0f * (yz + wx) * scale[1];
+  m[7] = 0.0f;
+  m[8] = 2.0f * (xz + wy) * scale[2];
+  m[9] = 2.0f * (yz - wx) * scale[2];
+  m[10] = (1.0f - 2.0f * (xx + yy)) * scale[2];
+  m[11] = 0.0f;
+  m[12] = translation[0];
+  m[13] = translation[1];
+  m[14] = translation[2];
+  m[15] = 1.0f;
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "job_pool.h"
+#include "mat4.h"
+
+// Transform hierarchy. Every node has a local translation, rotation
+// (quaternion) and scale and a world matrix = parent world * local. The
+// components live in separate arrays indexed by node, a parent always has a
+// lower index than its children.
+//
+// Setting a component only marks the node dirty. update_transform_graph
+// marks the children of dirty nodes dirty as well, sorts the dirty nodes by
+// depth and recomputes one level at a time: nodes on the same level don't
+// depend on each other, so each level is split over the job pool. Clean
+// subtrees aren't touched, and a graph without changes costs nothing.
+//
+//   uint32_t node = add_transform_node(&graph, TRANSFORM_NO_PARENT);
+//   set_transform_rotation(&graph, node, rotation);
+//   update_transform_graph(&graph, &pool);
+//   setup_matrix(shader, "model", transform_world(&graph, node));
+
+#define TRANSFORM_NO_PARENT UINT32_MAX
+#define TRANSFORM_UPDATE_BATCH 512 // nodes per job
+
+struct transform_graph {
+  uint32_t count, capacity;
+
+  uint32_t *parents; // TRANSFORM_NO_PARENT for roots
+  uint32_t *depths;  // 0 for roots
+  float *translations, *rotations, *scales; // 3, 4 and 3 floats per node
+  float *worlds;                            // column major mat4 per node
+  uint8_t *dirty;
+
+  // Lowest dirty index, count if nothing changed since the last update
+  uint32_t first_dirty;
+
+  // Dirty nodes sorted by depth, level d is order[level_starts[d] ..
+  // level_starts[d + 1]). Rebuilt by every update.
+  uint32_t *order;
+  uint32_t *level_starts;
+  uint32_t level_count;
+
+  uint32_t updated; // nodes recomputed by the last update
+};
+
+void init_transform_graph(struct transform_graph *graph) {
+  memset(graph, 0, sizeof(*graph));
+}
+
+static void transform_graph_grow(struct transform_graph *graph) {
+  uint32_t capacity = graph->capacity ? graph->capacity * 2 : 64;
+
+  graph->parents = realloc(graph->parents, sizeof(uint32_t) * capacity);
+  graph->depths = realloc(graph->depths, sizeof(uint32_t) * capacity);
+  graph->translations =
+      realloc(graph->translations, sizeof(float) * 3 * capacity);
+  graph->rotations = realloc(graph->rotations, sizeof(float) * 4 * capacity);
+  graph->scales = realloc(graph->scales, sizeof(float) * 3 * capacity);
+  graph->worlds = realloc(graph->worlds, sizeof(float) * 16 * capacity);
+  graph->dirty = realloc(graph->dirty, capacity);
+  graph->order = realloc(graph->order, sizeof(uint32_t) * capacity);
+  graph->capacity = capacity;
+}
+
+static void mark_transform_dirty(struct transform_graph *graph, uint32_t node) {
+  graph->dirty[node] = 1;
+  if (node < graph->first_dirty)
+    graph->first_dirty = node;
+}
+
+// Adds a node with an identity transform, returns its index
+uint32_t add_transform_node(struct transform_graph *graph, uint32_t parent) {
+  if (graph->count == graph->capacity)
+    transform_graph_grow(graph);
+
+  uint32_t node = graph->count++;
+  graph->parents[node] = parent;
+  graph->depths[node] =
+      parent == TRANSFORM_NO_PARENT ? 0 : graph->depths[parent] + 1;
+
+  float *t = graph->translations + node * 3;
+  float *s = graph->scales + node * 3;
+  t[0] = t[1] = t[2] = 0.0f;
+  s[0] = s[1] = s[2] = 1.0f;
+  quat_identity(graph->rotations + node * 4);
+  mat4_identity(graph->worlds + node * 16);
+
+  mark_transform_dirty(graph, node);
+  return node;
+}
+
+void set_transform_translation(
+    struct transform_graph *graph,
+    uint32_t node,
+    float x,
+    float y,
+    float z
+) {
+  float *t = graph->translations + node * 3;
+  t[0] = x;
+  t[1] = y;
+  t[2] = z;
+  mark_transform_dirty(graph, node);
+}
+
+// `rotation` is a normalized quaternion
+void set_transform_rotation(
+    struct transform_graph *graph,
+    uint32_t node,
+    const float *rotation
+) {
+  memcpy(graph->rotations + node * 4, rotation, sizeof(float) * 4);
+  mark_transform_dirty(graph, node);
+}
+
+void set_transform_scale(
+    struct transform_graph *graph,
+    uint32_t node,
+    float x,
+    float y,
+    float z
+) {
+  float *s = graph->scales + node * 3;
+  s[0] = x;
+  s[1] = y;
+  s[2] = z;
+  mark_transform_dirty(graph, node);
+}
+
+// Valid after update_transform_graph
+const float *transform_world(
+    const struct transform_graph *graph,
+    uint32_t node
+) {
+  return graph->worlds + node * 16;
+}
+
+struct transform_update_job {
+  struct transform_graph *graph;
+  const uint32_t *nodes;
+};
+
+static void update_transform_batch(void *data, size_t begin, size_t end) {
+  struct transform_update_job *job = data;
+  struct transform_graph *graph = job->graph;
+
+  for (size_t i = begin; i < end; i++) {
+    uint32_t node = job->nodes[i];
+    uint32_t parent = graph->parents[node];
+    float *world = graph->worlds + node * 16;
+
+    mat4_from_trs(
+        world,
+        graph->translations + node * 3,
+        graph->rotations + node * 4,
+        graph->scales + node * 3
+    );
+    if (parent != TRANSFORM_NO_PARENT)
+      mat4_multiply(world, graph->worlds + parent * 16, world);
+
+    graph->dirty[node] = 0;
+  }
+}
+
+// Recomputes the world matrices of dirty nodes and everything below them.
+// pool may be NULL to do it all on the calling thread.
+void update_transform_graph(
+    struct transform_graph *graph,
+    struct job_pool *pool
+) {
+  graph->updated = 0;
+  if (graph->first_dirty >= graph->count) {
+    graph->first_dirty = graph->count;
+    return;
+  }
+
+  // Parents come first, so one pass pushes the flags all the way down.
+  // Count the dirty nodes per level on the way.
+  uint32_t levels = 0;
+  for (uint32_t node = graph->first_dirty; node < graph->count; node++) {
+    uint32_t parent = graph->parents[node];
+    if (parent != TRANSFORM_NO_PARENT && graph->dirty[parent])
+      graph->dirty[node] = 1;
+    if (graph->dirty[node] && graph->depths[node] + 1 > levels)
+      levels = graph->depths[node] + 1;
+  }
+
+  if (levels + 1 > graph->level_count) {
+    graph->level_starts =
+        realloc(graph->level_starts, sizeof(uint32_t) * (levels + 1));
+    graph->level_count = levels + 1;
+  }
+  memset(graph->level_starts, 0, sizeof(uint32_t) * (levels + 1));
+
+  for (uint32_t node = graph->first_dirty; node < graph->count; node++) {
+    if (graph->dirty[node])
+      graph->level_starts[graph->depths[node] + 1]++;
+  }
+  for (uint32_t level = 0; level < levels; level++)
+    graph->level_starts[level + 1] += graph->level_starts[level];
+
+  // Counting sort, nodes stay in index order within a level. Filling moves
+  // every start to the end of its level, shifting by one entry fixes that.
+  uint32_t *cursor = graph->level_starts;
+  for (uint32_t node = graph->first_dirty; node < graph->count; node++) {
+    if (graph->dirty[node])
+      graph->order[cursor[graph->depths[node]]++] = node;
+  }
+  memmove(cursor + 1, cursor, sizeof(uint32_t) * levels);
+  cursor[0] = 0;
+
+  // Breadth first, a level can only start once its parents are done
+  for (uint32_t level = 0; level < levels; level++) {
+    uint32_t begin = graph->level_starts[level];
+    uint32_t count = graph->level_starts[level + 1] - begin;
+
+    struct transform_update_job job = {graph, graph->order + begin};
+    if (pool) {
+      job_pool_for(
+          pool,
+          count,
+          TRANSFORM_UPDATE_BATCH,
+          update_transform_batch,
+          &job
+      );
+    } else {
+      update_transform_batch(&job, 0, count);
+    }
+    graph->updated += count;
+  }
+
+  graph->first_dirty = graph->count;
+}
+
+void free_transform_graph(struct transform_graph *graph) {
+  free(graph->parents);
+  free(graph->depths);
+  free(graph->translations);
+  free(graph->rotations);
+  free(graph->scales);
+  free(graph->worlds);
+  free(graph->dirty);
+  free(graph->order);
+  free(graph->level_starts);
+  memset(graph, 0, sizeof(*graph));
+}
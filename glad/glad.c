@@ -175,27 +175,35 @@ static int get_exts(void) {
 #ifdef _GLAD_IS_SOME_NEW_VERSION
   } else {
     int index;
+    size_t total = 0;
+    char *local_str;
 
     num_exts_i = 0;
     glGetIntegerv(GL_NUM_EXTENSIONS, &num_exts_i);
+
+    /* One allocation holds the pointer table followed by every string */
+    for (index = 0; index < num_exts_i; index++) {
+      const char *gl_str_tmp =
+          (const char *) glGetStringi(GL_EXTENSIONS, index);
+      total += strlen(gl_str_tmp) + 1;
+    }
     if (num_exts_i > 0) {
-      exts_i = (char **) malloc((size_t) num_exts_i * (sizeof *exts_i));
+      exts_i = (char **) malloc((size_t) num_exts_i * (sizeof *exts_i) + total);
     }
 
     if (exts_i == NULL) {
       return 0;
     }
 
+    local_str = (char *) (exts_i + num_exts_i);
     for (index = 0; index < num_exts_i; index++) {
       const char *gl_str_tmp =
           (const char *) glGetStringi(GL_EXTENSIONS, index);
       size_t len = strlen(gl_str_tmp);
 
-      char *local_str = (char *) malloc((len + 1) * sizeof(char));
-      if (local_str != NULL) {
-        memcpy(local_str, gl_str_tmp, (len + 1) * sizeof(char));
-      }
+      memcpy(local_str, gl_str_tmp, (len + 1) * sizeof(char));
       exts_i[index] = local_str;
+      local_str += len + 1;
     }
   }
 #endif
@@ -204,10 +212,7 @@ static int get_exts(void) {
 
 static void free_exts(void) {
   if (exts_i != NULL) {
-    int index;
-    for (index = 0; index < num_exts_i; index++) {
-      free((char *) exts_i[index]);
-    }
+    /* The strings share the allocation of the table */
     free((void *) exts_i);
     exts_i = NULL;
   }
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "post_processing.h"
+
+// Bloom as a post processing effect. The bright parts of the image are
+// downsampled into a pyramid of half, quarter, ... resolution levels and
+// every level gets a separable Gaussian blur, then the levels are added
+// back up from the smallest one. A blur on a level 2^n times smaller is
+// 2^n times wider on the screen but only touches 1/4^n of the pixels, so
+// the whole pyramid costs about 4/3 of the first level however wide the
+// glow gets.
+//
+// The blur is the 9 tap binomial kernel done with 5 texture reads: two
+// neighbouring taps are merged into one bilinear read placed between them,
+// weighted so the hardware filter produces their weighted sum.
+//
+// The levels come from post_processing_pool and only live for the frame,
+// the blur scratch of a level is handed back as soon as it's blurred. If the
+// pool runs out, that frame goes without the glow.
+// Every level is timed on its own when post_processing_timer is set.
+
+#define BLOOM_MAX_LEVELS 6
+
+struct bloom_level {
+  int width, height;
+  int target; // pool index, -1 outside of the bloom's passes
+};
+
+struct bloom {
+  struct bloom_level levels[BLOOM_MAX_LEVELS];
+  int level_count;
+
+  float threshold; // brightness where the glow starts
+  float intensity;
+
+  GLuint downsample_program, blur_program, upsample_program;
+  GLuint sampler;       // linear, the pool's targets are nearest
+  GLuint black_texture; // the glow when there are no targets for it
+  GLint texel_location, threshold_location, direction_location;
+
+  int effect; // index in the post processing chain
+  char level_names[BLOOM_MAX_LEVELS][2][16];
+};
+
+const char *bloom_downsample_fragment =
+    "#version 410 core\n"
+    "out vec4 color;\n"
+    "in vec2 out_tex_coords;\n"
+
+    "uniform sampler2D source;\n"
+    "uniform vec2 texel;\n"
+    "uniform float threshold;\n"
+
+    "void main() {\n"
+    // Four bilinear reads average the 4x4 source texels around this pixel
+    "    vec2 uv = out_tex_coords;\n"
+    "    vec4 sum = texture(source, uv + texel * vec2(-1.0, -1.0))\n"
+    "             + texture(source, uv + texel * vec2(1.0, -1.0))\n"
+    "             + texture(source, uv + texel * vec2(-1.0, 1.0))\n"
+    "             + texture(source, uv + texel * vec2(1.0, 1.0));\n"
+    "    vec3 average = sum.rgb * 0.25;\n"
+    "    float brightness = max(average.r, max(average.g, average.b));\n"
+    "    float keep = max(brightness - threshold, 0.0);\n"
+    "    color = vec4(average * keep / max(brightness, 1e-4), 1.0);\n"
+    "}\n";
+
+const char *bloom_blur_fragment =
+    "#version 410 core\n"
+    "out vec4 color;\n"
+    "in vec2 out_tex_coords;\n"
+
+    "uniform sampler2D source;\n"
+    "uniform vec2 direction;\n" // one texel along x or y
+
+    // Binomial weights 924, 792, 495, 220 & 66 out of 4070 (row 12 without
+    // its two outermost entries), neighbours merged into one read
+    "const float offsets[3] = float[](0.0, 1.3846153846, 3.2307692308);\n"
+    "const float weights[3] = float[](0.2270270270, 0.3162162162, "
+    "0.0702702703);\n"
+
+    "void main() {\n"
+    "    vec2 uv = out_tex_coords;\n"
+    "    vec3 sum = texture(source, uv).rgb * weights[0];\n"
+    "    for (int i = 1; i < 3; i++) {\n"
+    "        vec2 offset = direction * offsets[i];\n"
+    "        sum += texture(source, uv + offset).rgb * weights[i];\n"
+    "        sum += texture(source, uv - offset).rgb * weights[i];\n"
+    "    }\n"
+    "    color = vec4(sum, 1.0);\n"
+    "}\n";
+
+// Drawn with additive blending onto the next bigger level
+const char *bloom_upsample_fragment =
+    "#version 410 core\n"
+    "out vec4 color;\n"
+    "in vec2 out_tex_coords;\n"
+
+    "uniform sampler2D source;\n"
+
+    "void main() {\n"
+    "    color = texture(source, out_tex_coords);\n"
+    "}\n";
+
+// The effect's own pass, the image plus the glow
+const char *bloom_composite_fragment =
+    "#version 410 core\n"
+    "out vec4 color;\n"
+    "in vec2 out_tex_coords;\n"
+
+    "uniform sampler2D screen_texture;\n"
+    "uniform sampler2D bloom_texture;\n"
+    "uniform float bloom_intensity;\n"
+
+    "void main() {\n"
+    "    vec4 glow = texture(bloom_texture, out_tex_coords);\n"
+    "    color = texture(screen_texture, out_tex_coords);\n"
+    "    color.rgb += glow.rgb * bloom_intensity;\n"
+    "}\n";
+
+static void bloom_draw(int target, int width, int height, GLuint source) {
+  glBindFramebuffer(GL_FRAMEBUFFER, post_processing_pool.targets[target].fbo);
+  glViewport(0, 0, width, height);
+  glBindTexture(GL_TEXTURE_2D, source);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+static GLuint bloom_texture(int target) {
+  return post_processing_pool.targets[target].handle;
+}
+
+// Small floats keep the sums from clipping at 1. Returns -1 if the pool is
+// out of targets.
+static int bloom_acquire(int width, int height, const char *owner) {
+  return acquire_texture(
+      &post_processing_pool,
+      GL_R11F_G11F_B10F,
+      width,
+      height,
+      owner
+  );
+}
+
+// Hands back the first count levels
+static void bloom_release_levels(struct bloom *bloom, int count) {
+  for (int i = 0; i < count; i++) {
+    release_target(&post_processing_pool, bloom->levels[i].target);
+    bloom->levels[i].target = -1;
+  }
+}
+
+// The composite pass reads the glow from unit 1
+static void bloom_bind_glow(const struct bloom *bloom, GLuint glow) {
+  const struct post_effect *effect = &post_chain.effects[bloom->effect];
+  glUseProgram(effect->program);
+  glUniform1f(
+      glGetUniformLocation(effect->program, "bloom_intensity"),
+      bloom->intensity
+  );
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, glow);
+  glBindSampler(1, bloom->sampler);
+}
+
+// The prepare hook, builds the glow from the image the effect gets
+static void bloom_prepare(void *data, GLuint source) {
+  struct bloom *bloom = data;
+
+  glBindVertexArray(screen_rect_vao);
+  glActiveTexture(GL_TEXTURE0);
+  glBindSampler(0, bloom->sampler);
+
+  // Down the pyramid: a filtered half size copy, blurred across and down
+  int width = render_width, height = render_height;
+  for (int i = 0; i < bloom->level_count; i++) {
+    struct bloom_level *level = &bloom->levels[i];
+    int section =
+        gpu_timer_begin(post_processing_timer, bloom->level_names[i][0]);
+
+    glUseProgram(bloom->downsample_program);
+    glUniform2f(
+        bloom->texel_location,
+        1.0f / (float) width,
+        1.0f / (float) height
+    );
+    glUniform1f(bloom->threshold_location, i == 0 ? bloom->threshold : 0.0f);
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+    level->width = width;
+    level->height = height;
+    level->target = bloom_acquire(width, height, "bloom");
+    int scratch = bloom_acquire(width, height, "bloom blur");
+    if (level->target < 0 || scratch < 0) {
+      release_target(&post_processing_pool, scratch);
+      gpu_timer_end(post_processing_timer, section);
+      bloom_release_levels(bloom, i + 1);
+      glBindSampler(0, 0);
+      bloom_bind_glow(bloom, bloom->black_texture);
+      return;
+    }
+    bloom_draw(level->target, width, height, source);
+
+    glUseProgram(bloom->blur_program);
+    glUniform2f(bloom->direction_location, 1.0f / (float) width, 0.0f);
+    bloom_draw(scratch, width, height, bloom_texture(level->target));
+    glUniform2f(bloom->direction_location, 0.0f, 1.0f / (float) height);
+    bloom_draw(level->target, width, height, bloom_texture(scratch));
+    release_target(&post_processing_pool, scratch);
+
+    gpu_timer_end(post_processing_timer, section);
+    source = bloom_texture(level->target);
+  }
+
+  // And back up, every level adds its glow to the one above it and is done
+  glUseProgram(bloom->upsample_program);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE);
+  for (int i = bloom->level_count - 1; i > 0; i--) {
+    struct bloom_level *level = &bloom->levels[i];
+    struct bloom_level *target = &bloom->levels[i - 1];
+    int section =
+        gpu_timer_begin(post_processing_timer, bloom->level_names[i][1]);
+    bloom_draw(
+        target->target,
+        target->width,
+        target->height,
+        bloom_texture(level->target)
+    );
+    gpu_timer_end(post_processing_timer, section);
+    release_target(&post_processing_pool, level->target);
+    level->target = -1;
+  }
+  glDisable(GL_BLEND);
+  glBindSampler(0, 0);
+
+  bloom_bind_glow(bloom, bloom_texture(bloom->levels[0].target));
+}
+
+// The finish hook, the composite is done with the glow
+static void bloom_finish(void *data) {
+  struct bloom *bloom = data;
+  glBindSampler(1, 0);
+  bloom_release_levels(bloom, 1);
+}
+
+static GLuint bloom_program(const char *fragment_source) {
+  GLuint program = create_shader(post_processing_vertex, fragment_source);
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "source"), 0);
+  return program;
+}
+
+// Adds bloom to the end of the post processing chain, levels is how many
+// halvings the glow spreads over (at most BLOOM_MAX_LEVELS). Returns the
+// effect's index or -1.
+int add_bloom_effect(struct bloom *bloom, int levels) {
+  memset(bloom, 0, sizeof(*bloom));
+  if (levels < 1)
+    levels = 1;
+  if (levels > BLOOM_MAX_LEVELS)
+    levels = BLOOM_MAX_LEVELS;
+  bloom->level_count = levels;
+  bloom->threshold = 0.6f;
+  bloom->intensity = 0.8f;
+
+  bloom->effect = add_post_effect("bloom", bloom_composite_fragment);
+  if (bloom->effect < 0)
+    return -1;
+
+  struct post_effect *effect = &post_chain.effects[bloom->effect];
+  glUseProgram(effect->program);
+  glUniform1i(glGetUniformLocation(effect->program, "bloom_texture"), 1);
+  effect->prepare = bloom_prepare;
+  effect->finish = bloom_finish;
+  effect->data = bloom;
+
+  bloom->downsample_program = bloom_program(bloom_downsample_fragment);
+  bloom->texel_location =
+      glGetUniformLocation(bloom->downsample_program, "texel");
+  bloom->threshold_location =
+      glGetUniformLocation(bloom->downsample_program, "threshold");
+  bloom->blur_program = bloom_program(bloom_blur_fragment);
+  bloom->direction_location =
+      glGetUniformLocation(bloom->blur_program, "direction");
+  bloom->upsample_program = bloom_program(bloom_upsample_fragment);
+
+  glGenSamplers(1, &bloom->sampler);
+  glSamplerParameteri(bloom->sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glSamplerParameteri(bloom->sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glSamplerParameteri(bloom->sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glSamplerParameteri(bloom->sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  const unsigned char black[4] = {0, 0, 0, 255};
+  glGenTextures(1, &bloom->black_texture);
+  glBindTexture(GL_TEXTURE_2D, bloom->black_texture);
+  glTexImage2D(
+      GL_TEXTURE_2D,
+      0,
+      GL_RGBA8,
+      1,
+      1,
+      0,
+      GL_RGBA,
+      GL_UNSIGNED_BYTE,
+      black
+  );
+
+  for (int i = 0; i < BLOOM_MAX_LEVELS; i++) {
+    bloom->levels[i].target = -1;
+    snprintf(bloom->level_names[i][0], 16, "bloom %d", i);
+    snprintf(bloom->level_names[i][1], 16, "bloom up %d", i);
+  }
+
+  return bloom->effect;
+}
+
+void free_bloom(struct bloom *bloom) {
+  glDeleteProgram(bloom->downsample_program);
+  glDeleteProgram(bloom->blur_program);
+  glDeleteProgram(bloom->upsample_program);
+  glDeleteSamplers(1, &bloom->sampler);
+  glDeleteTextures(1, &bloom->black_texture);
+  memset(bloom, 0, sizeof(*bloom));
+}
@@ -0,0 +1,622 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gpu_timer.h"
+#include "target_pool.h"
+
+// A frame declared as passes and the targets they read and write, instead
+// of framebuffer binds in the right order. Passes run in the order they are
+// added. Compiling the graph (once, and again when the sizes change):
+//
+// - culls the passes nothing on the screen depends on, going backwards from
+//   the screen through what every needed pass reads
+// - merges clears: a pass that only clears (no execute) is folded into the
+//   next pass writing the same target, and every pass clears all of its
+//   attachments with a single glClear
+// - works out the lifetime of every target, from the first pass using it
+//   to the last, and takes targets from the pool in that order, so targets
+//   whose lifetimes don't overlap end up sharing memory
+// - makes one framebuffer per pass
+//
+// Multisampled renderbuffers can't be read by shaders, a resolve pass
+// (add_graph_resolve_pass) blits one into a texture of the same size.
+//
+// Running it binds each pass's framebuffer, sets the viewport, clears and
+// calls the pass. Resource 0 (FRAME_GRAPH_SCREEN) is the default
+// framebuffer.
+//
+//   reset_frame_graph(&graph, screen_width, screen_height);
+//   int color = graph_texture(&graph, "scene", GL_RGB8, width, height);
+//   int scene = add_graph_pass(&graph, "scene", draw_scene, NULL);
+//   graph_write(&graph, scene, color, 1);
+//   int blur = add_graph_pass(&graph, "blur", draw_blur, NULL);
+//   graph_read(&graph, blur, color);
+//   graph_write(&graph, blur, FRAME_GRAPH_SCREEN, 0);
+//   compile_frame_graph(&graph);
+//   ...
+//   execute_frame_graph(&graph); // every frame
+
+#define FRAME_GRAPH_MAX_PASSES 16
+#define FRAME_GRAPH_MAX_RESOURCES 16
+#define FRAME_GRAPH_MAX_READS 4
+#define FRAME_GRAPH_SCREEN 0
+
+struct frame_graph;
+
+typedef void (*graph_execute)(struct frame_graph *graph, int pass, void *data);
+
+struct graph_resource {
+  char name[32];
+  GLenum format;
+  int width, height;
+  int renderbuffer;
+  int samples; // above 1 for multisampled renderbuffers
+  float clear_color[4];
+
+  // Filled in by compile_frame_graph
+  int needed;      // something on the screen depends on it
+  int first, last; // schedule positions using it, -1 if none does
+  int target;      // pool index, -1 for the screen & unused resources
+};
+
+struct graph_pass {
+  char name[64];
+  graph_execute execute; // NULL for a pass that only clears
+  void *data;
+
+  int reads[FRAME_GRAPH_MAX_READS];
+  int read_count;
+  int color, depth; // resources written, -1 for none
+  GLbitfield clear; // attachments cleared before the pass runs
+  int resolve;      // resource a resolve pass blits from, -1 otherwise
+
+  // Filled in by compile_frame_graph
+  int culled; // 1 if nothing needs it, 2 if its clears were merged
+  GLuint fbo;
+  GLuint read_fbo; // resolve passes, with the resolved resource on it
+  int width, height;
+};
+
+struct frame_graph {
+  struct target_pool *pool;
+  struct gpu_timer *timer; // optional, every pass is timed under its name
+
+  struct graph_resource resources[FRAME_GRAPH_MAX_RESOURCES];
+  int resource_count;
+  struct graph_pass passes[FRAME_GRAPH_MAX_PASSES];
+  int pass_count;
+
+  int schedule[FRAME_GRAPH_MAX_PASSES];
+  int schedule_length;
+  int compiled;
+};
+
+static int graph_is_depth(GLenum format) {
+  return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH_COMPONENT24
+      || format == GL_DEPTH_COMPONENT32F;
+}
+
+static int graph_add_resource(
+    struct frame_graph *graph,
+    const char *name,
+    GLenum format,
+    int width,
+    int height,
+    int renderbuffer,
+    int samples
+) {
+  if (graph->resource_count == FRAME_GRAPH_MAX_RESOURCES) {
+    printf("Too many frame graph resources, %s is skipped\n", name);
+    return -1;
+  }
+
+  struct graph_resource *resource = &graph->resources[graph->resource_count];
+  memset(resource, 0, sizeof(*resource));
+  snprintf(resource->name, sizeof(resource->name), "%s", name);
+  resource->format = format;
+  resource->width = width;
+  resource->height = height;
+  resource->renderbuffer = renderbuffer;
+  resource->samples = samples;
+  resource->clear_color[3] = 1.0f;
+  resource->first = resource->last = resource->target = -1;
+  return graph->resource_count++;
+}
+
+// Throws away the passes, resources and everything compiled from them, and
+// starts over with just the screen
+void reset_frame_graph(
+    struct frame_graph *graph,
+    int screen_width,
+    int screen_height
+) {
+  // Resources that shared a target hand it back once
+  for (int i = 0; i < graph->resource_count; i++) {
+    int target = graph->resources[i].target, shared = 0;
+    for (int k = 0; k < i; k++)
+      shared |= graph->resources[k].target == target;
+    if (!shared)
+      release_target(graph->pool, target);
+  }
+  for (int i = 0; i < graph->pass_count; i++) {
+    glDeleteFramebuffers(1, &graph->passes[i].fbo);
+    glDeleteFramebuffers(1, &graph->passes[i].read_fbo);
+  }
+
+  graph->resource_count = 0;
+  graph->pass_count = 0;
+  graph->schedule_length = 0;
+  graph->compiled = 0;
+  graph_add_resource(
+      graph,
+      "screen",
+      GL_RGBA8,
+      screen_width,
+      screen_height,
+      0,
+      1
+  );
+}
+
+void init_frame_graph(struct frame_graph *graph, struct target_pool *pool) {
+  memset(graph, 0, sizeof(*graph));
+  graph->pool = pool;
+  reset_frame_graph(graph, 1, 1);
+}
+
+// A texture the passes can write and read later, returns its index or -1
+int graph_texture(
+    struct frame_graph *graph,
+    const char *name,
+    GLenum format,
+    int width,
+    int height
+) {
+  return graph_add_resource(graph, name, format, width, height, 0, 1);
+}
+
+// A renderbuffer, which can be written (depth for example) but not read
+int graph_renderbuffer(
+    struct frame_graph *graph,
+    const char *name,
+    GLenum format,
+    int width,
+    int height
+) {
+  return graph_add_resource(graph, name, format, width, height, 1, 1);
+}
+
+// With samples per pixel, only a resolve pass can read it
+int graph_multisample_renderbuffer(
+    struct frame_graph *graph,
+    const char *name,
+    GLenum format,
+    int samples,
+    int width,
+    int height
+) {
+  return graph_add_resource(graph, name, format, width, height, 1, samples);
+}
+
+void set_graph_clear_color(
+    struct frame_graph *graph,
+    int resource,
+    float r,
+    float g,
+    float b,
+    float a
+) {
+  float *color = graph->resources[resource].clear_color;
+  color[0] = r;
+  color[1] = g;
+  color[2] = b;
+  color[3] = a;
+}
+
+// execute may be NULL for a pass that only clears what it writes
+int add_graph_pass(
+    struct frame_graph *graph,
+    const char *name,
+    graph_execute execute,
+    void *data
+) {
+  if (graph->pass_count == FRAME_GRAPH_MAX_PASSES) {
+    printf("Too many frame graph passes, %s is skipped\n", name);
+    return -1;
+  }
+
+  struct graph_pass *pass = &graph->passes[graph->pass_count];
+  memset(pass, 0, sizeof(*pass));
+  snprintf(pass->name, sizeof(pass->name), "%s", name);
+  pass->execute = execute;
+  pass->data = data;
+  pass->color = pass->depth = pass->resolve = -1;
+  return graph->pass_count++;
+}
+
+void graph_read(struct frame_graph *graph, int pass, int resource) {
+  struct graph_pass *p = &graph->passes[pass];
+  if (p->read_count == FRAME_GRAPH_MAX_READS) {
+    printf("Pass %s reads too many resources\n", p->name);
+    return;
+  }
+  p->reads[p->read_count++] = resource;
+}
+
+// Makes the resource the pass's colour or depth attachment, depending on
+// its format. With clear set it's cleared before the pass.
+void graph_write(struct frame_graph *graph, int pass, int resource, int clear) {
+  struct graph_pass *p = &graph->passes[pass];
+  GLenum format = graph->resources[resource].format;
+
+  if (graph_is_depth(format)) {
+    p->depth = resource;
+    if (clear)
+      p->clear |= GL_DEPTH_BUFFER_BIT;
+    if (clear && format == GL_DEPTH24_STENCIL8)
+      p->clear |= GL_STENCIL_BUFFER_BIT;
+  } else {
+    p->color = resource;
+    if (clear)
+      p->clear |= GL_COLOR_BUFFER_BIT;
+  }
+}
+
+static void graph_resolve(struct frame_graph *graph, int pass, void *data) {
+  const struct graph_pass *p = &graph->passes[pass];
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, p->read_fbo);
+  glBlitFramebuffer(
+      0,
+      0,
+      p->width,
+      p->height,
+      0,
+      0,
+      p->width,
+      p->height,
+      GL_COLOR_BUFFER_BIT,
+      GL_NEAREST
+  );
+}
+
+// Blits a multisampled colour resource into destination, which has to have
+// the same size & format. Returns the pass or -1.
+int add_graph_resolve_pass(
+    struct frame_graph *graph,
+    const char *name,
+    int source,
+    int destination
+) {
+  int pass = add_graph_pass(graph, name, graph_resolve, NULL);
+  if (pass < 0)
+    return -1;
+
+  graph_read(graph, pass, source);
+  graph_write(graph, pass, destination, 0);
+  graph->passes[pass].resolve = source;
+  return pass;
+}
+
+static int graph_pass_reads(const struct graph_pass *pass, int resource) {
+  for (int i = 0; i < pass->read_count; i++) {
+    if (pass->reads[i] == resource)
+      return 1;
+  }
+  return 0;
+}
+
+static int graph_pass_writes(const struct graph_pass *pass, int resource) {
+  return resource >= 0 && (pass->color == resource || pass->depth == resource);
+}
+
+// Going backwards, a pass is needed if it writes something needed, and then
+// everything it reads is needed too
+static void graph_cull(struct frame_graph *graph) {
+  graph->resources[FRAME_GRAPH_SCREEN].needed = 1;
+  for (int i = graph->pass_count - 1; i >= 0; i--) {
+    struct graph_pass *pass = &graph->passes[i];
+    int needed = (pass->color >= 0 && graph->resources[pass->color].needed)
+              || (pass->depth >= 0 && graph->resources[pass->depth].needed);
+    pass->culled = !needed;
+    if (!needed)
+      continue;
+
+    for (int k = 0; k < pass->read_count; k++)
+      graph->resources[pass->reads[k]].needed = 1;
+  }
+}
+
+// Moves the clear of one attachment of a clear only pass into the next
+// pass writing it, if nothing reads the cleared contents in between
+static void graph_merge_clear(
+    struct frame_graph *graph,
+    int from,
+    int resource,
+    GLbitfield bits
+) {
+  struct graph_pass *pass = &graph->passes[from];
+  if (resource < 0 || !(pass->clear & bits))
+    return;
+
+  for (int i = from + 1; i < graph->pass_count; i++) {
+    struct graph_pass *next = &graph->passes[i];
+    if (next->culled)
+      continue;
+    if (graph_pass_reads(next, resource))
+      return;
+    if (!graph_pass_writes(next, resource))
+      continue;
+
+    // A clear of the whole attachment, the next pass has the same size
+    next->clear |= pass->clear & bits;
+    pass->clear &= ~bits;
+    return;
+  }
+}
+
+static void graph_merge_clears(struct frame_graph *graph) {
+  for (int i = 0; i < graph->pass_count; i++) {
+    struct graph_pass *pass = &graph->passes[i];
+    if (pass->culled || pass->execute)
+      continue;
+
+    graph_merge_clear(graph, i, pass->color, GL_COLOR_BUFFER_BIT);
+    graph_merge_clear(
+        graph,
+        i,
+        pass->depth,
+        GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT
+    );
+    if (!pass->clear)
+      pass->culled = 2;
+  }
+}
+
+static void graph_use(struct frame_graph *graph, int resource, int position) {
+  struct graph_resource *r = &graph->resources[resource];
+  if (r->first < 0)
+    r->first = position;
+  r->last = position;
+}
+
+// Puts a resource on the bound framebuffer
+static void graph_attach(
+    const struct frame_graph *graph,
+    int resource,
+    GLenum attachment
+) {
+  const struct graph_resource *r = &graph->resources[resource];
+  GLuint handle = graph->pool->targets[r->target].handle;
+  if (r->renderbuffer) {
+    glFramebufferRenderbuffer(
+        GL_FRAMEBUFFER,
+        attachment,
+        GL_RENDERBUFFER,
+        handle
+    );
+  } else {
+    glFramebufferTexture2D(
+        GL_FRAMEBUFFER,
+        attachment,
+        GL_TEXTURE_2D,
+        handle,
+        0
+    );
+  }
+}
+
+static int graph_make_framebuffer(
+    struct frame_graph *graph,
+    struct graph_pass *pass
+) {
+  int size_of = pass->color >= 0 ? pass->color : pass->depth;
+  pass->width = graph->resources[size_of].width;
+  pass->height = graph->resources[size_of].height;
+  if (pass->color == FRAME_GRAPH_SCREEN) {
+    if (pass->depth >= 0) {
+      printf("Pass %s can't use a depth target with the screen\n", pass->name);
+      return 0;
+    }
+    return 1;
+  }
+
+  glGenFramebuffers(1, &pass->fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, pass->fbo);
+
+  if (pass->color >= 0)
+    graph_attach(graph, pass->color, GL_COLOR_ATTACHMENT0);
+  if (pass->depth >= 0) {
+    GLenum attachment = GL_DEPTH_ATTACHMENT;
+    if (graph->resources[pass->depth].format == GL_DEPTH24_STENCIL8)
+      attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+    graph_attach(graph, pass->depth, attachment);
+  }
+
+  // Depth only passes don't draw any colour
+  if (pass->color < 0)
+    glDrawBuffer(GL_NONE);
+
+  int complete =
+      glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+  // What a resolve pass blits from
+  if (complete && pass->resolve >= 0) {
+    glGenFramebuffers(1, &pass->read_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, pass->read_fbo);
+    graph_attach(graph, pass->resolve, GL_COLOR_ATTACHMENT0);
+    complete =
+        glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if (!complete)
+    printf("Pass %s has an incomplete framebuffer\n", pass->name);
+  return complete;
+}
+
+// Turns the declared passes into the schedule execute_frame_graph runs.
+// Returns 0 (and says why) if the graph doesn't make sense.
+int compile_frame_graph(struct frame_graph *graph) {
+  graph_cull(graph);
+  graph_merge_clears(graph);
+
+  graph->schedule_length = 0;
+  for (int i = 0; i < graph->pass_count; i++) {
+    struct graph_pass *pass = &graph->passes[i];
+    if (pass->culled)
+      continue;
+
+    int position = graph->schedule_length++;
+    graph->schedule[position] = i;
+
+    for (int k = 0; k < pass->read_count; k++) {
+      const struct graph_resource *resource = &graph->resources[pass->reads[k]];
+      int blit = pass->reads[k] == pass->resolve;
+      if (resource->first < 0 || (resource->renderbuffer && !blit)
+          || pass->reads[k] == FRAME_GRAPH_SCREEN) {
+        printf("Pass %s can't read %s\n", pass->name, resource->name);
+        return 0;
+      }
+      graph_use(graph, pass->reads[k], position);
+    }
+    if (pass->color >= 0)
+      graph_use(graph, pass->color, position);
+    if (pass->depth >= 0)
+      graph_use(graph, pass->depth, position);
+  }
+
+  // Targets are taken when their lifetime starts and given back when it
+  // ends, a target given back is free for the ones starting later
+  for (int position = 0; position < graph->schedule_length; position++) {
+    for (int i = 1; i < graph->resource_count; i++) {
+      struct graph_resource *resource = &graph->resources[i];
+      if (resource->first != position)
+        continue;
+
+      resource->target = target_pool_acquire(
+          graph->pool,
+          resource->renderbuffer,
+          resource->format,
+          resource->samples,
+          resource->width,
+          resource->height,
+          resource->name
+      );
+      if (resource->target < 0)
+        return 0;
+    }
+
+    for (int i = 1; i < graph->resource_count; i++) {
+      struct graph_resource *resource = &graph->resources[i];
+      if (resource->last == position)
+        release_target(graph->pool, resource->target);
+    }
+  }
+
+  // The graph keeps them until it's reset, under their first owner's name
+  for (int i = 1; i < graph->resource_count; i++) {
+    struct graph_resource *resource = &graph->resources[i];
+    if (resource->target >= 0) {
+      struct pooled_target *target = &graph->pool->targets[resource->target];
+      snprintf(target->owner, sizeof(target->owner), "%s", resource->name);
+    }
+  }
+
+  for (int i = 0; i < graph->schedule_length; i++) {
+    struct graph_pass *pass = &graph->passes[graph->schedule[i]];
+    if ((pass->color >= 0 || pass->depth >= 0)
+        && !graph_make_framebuffer(graph, pass))
+      return 0;
+  }
+
+  graph->compiled = 1;
+  return 1;
+}
+
+// Texture of a resource to read in a pass, 0 for the screen
+GLuint graph_resource_texture(const struct frame_graph *graph, int resource) {
+  int target = graph->resources[resource].target;
+  return target >= 0 ? graph->pool->targets[target].handle : 0;
+}
+
+// Binds the pass's framebuffer & viewport again, for passes that draw
+// somewhere else before their own work
+void bind_graph_pass(const struct frame_graph *graph, int pass) {
+  const struct graph_pass *p = &graph->passes[pass];
+  glBindFramebuffer(GL_FRAMEBUFFER, p->fbo);
+  glViewport(0, 0, p->width, p->height);
+}
+
+// Runs the compiled schedule, once per frame
+void execute_frame_graph(struct frame_graph *graph) {
+  for (int i = 0; i < graph->schedule_length; i++) {
+    int index = graph->schedule[i];
+    struct graph_pass *pass = &graph->passes[index];
+    int section = gpu_timer_begin(graph->timer, pass->name);
+
+    if (pass->color >= 0 || pass->depth >= 0)
+      bind_graph_pass(graph, index);
+    if (pass->clear & GL_COLOR_BUFFER_BIT) {
+      const float *color = graph->resources[pass->color].clear_color;
+      glClearColor(color[0], color[1], color[2], color[3]);
+    }
+    if (pass->clear)
+      glClear(pass->clear);
+    if (pass->execute)
+      pass->execute(graph, index, pass->data);
+
+    gpu_timer_end(graph->timer, section);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  target_pool_next_frame(graph->pool);
+}
+
+void print_frame_graph(const struct frame_graph *graph) {
+  int culled = 0, merged = 0;
+  for (int i = 0; i < graph->pass_count; i++) {
+    culled += graph->passes[i].culled == 1;
+    merged += graph->passes[i].culled == 2;
+  }
+  printf(
+      "Frame graph: %d passes, %d culled, %d clears merged\n",
+      graph->schedule_length,
+      culled,
+      merged
+  );
+
+  for (int i = 0; i < graph->schedule_length; i++) {
+    const struct graph_pass *pass = &graph->passes[graph->schedule[i]];
+    printf("  %d %s ->", i, pass->name);
+    int writes[2] = {pass->color, pass->depth};
+    for (int k = 0; k < 2; k++) {
+      if (writes[k] >= 0)
+        printf(" %s", graph->resources[writes[k]].name);
+    }
+    printf(pass->clear ? " (cleared)\n" : "\n");
+  }
+
+  for (int i = 1; i < graph->resource_count; i++) {
+    const struct graph_resource *resource = &graph->resources[i];
+    if (resource->first < 0)
+      continue;
+    printf(
+        "  %s %dx%d x%d, passes %d..%d, target %d\n",
+        resource->name,
+        resource->width,
+        resource->height,
+        resource->samples,
+        resource->first,
+        resource->last,
+        resource->target
+    );
+  }
+}
+
+void free_frame_graph(struct frame_graph *graph) {
+  reset_frame_graph(graph, 1, 1);
+  memset(graph, 0, sizeof(*graph));
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Measures how long the GPU spends on named parts of a frame. A section is
+// a pair of GL_TIMESTAMP queries, so sections can nest (a whole frame
+// around its passes) unlike GL_TIME_ELAPSED. Results are read
+// GPU_TIMER_LATENCY - 1 frames after they were recorded, by then the GPU
+// is done with them and reading never stalls. A result that still isn't
+// there is dropped.
+//
+//   int scene = gpu_timer_begin(&timer, "scene");
+//   ... draw ...
+//   gpu_timer_end(&timer, scene);
+//   ...
+//   SDL_GL_SwapWindow(window);
+//   gpu_timer_next_frame(&timer);
+//
+// Every function accepts a NULL timer and does nothing with it, so code can
+// be profiled optionally without checking first.
+
+#define GPU_TIMER_LATENCY 4 // frames a result gets to arrive
+#define GPU_TIMER_MAX_SECTIONS 32
+
+struct gpu_timer_section {
+  char name[32];
+  GLuint queries[GPU_TIMER_LATENCY][2]; // begin & end per frame
+  uint8_t recorded[GPU_TIMER_LATENCY];  // both queries were issued
+
+  float ms;      // newest result
+  float average; // smoothed over roughly the last 10 results
+  int samples;
+};
+
+struct gpu_timer {
+  struct gpu_timer_section sections[GPU_TIMER_MAX_SECTIONS];
+  int section_count;
+  int frame;   // which of the GPU_TIMER_LATENCY query sets is recorded
+  int dropped; // results that weren't ready in time
+};
+
+void init_gpu_timer(struct gpu_timer *timer) {
+  memset(timer, 0, sizeof(*timer));
+}
+
+// Looks a section up by name, creating it the first time. Returns -1 if
+// there are too many.
+int gpu_timer_section(struct gpu_timer *timer, const char *name) {
+  if (!timer)
+    return -1;
+
+  for (int i = 0; i < timer->section_count; i++) {
+    if (strcmp(timer->sections[i].name, name) == 0)
+      return i;
+  }
+
+  if (timer->section_count == GPU_TIMER_MAX_SECTIONS)
+    return -1;
+
+  struct gpu_timer_section *section = &timer->sections[timer->section_count];
+  memset(section, 0, sizeof(*section));
+  snprintf(section->name, sizeof(section->name), "%s", name);
+  glGenQueries(GPU_TIMER_LATENCY * 2, &section->queries[0][0]);
+  return timer->section_count++;
+}
+
+// Starts timing a section, returns the handle for gpu_timer_end
+int gpu_timer_begin(struct gpu_timer *timer, const char *name) {
+  int index = gpu_timer_section(timer, name);
+  if (index < 0)
+    return -1;
+
+  struct gpu_timer_section *section = &timer->sections[index];
+  glQueryCounter(section->queries[timer->frame][0], GL_TIMESTAMP);
+  section->recorded[timer->frame] = 0;
+  return index;
+}
+
+void gpu_timer_end(struct gpu_timer *timer, int index) {
+  if (!timer || index < 0)
+    return;
+
+  struct gpu_timer_section *section = &timer->sections[index];
+  glQueryCounter(section->queries[timer->frame][1], GL_TIMESTAMP);
+  section->recorded[timer->frame] = 1;
+}
+
+// Call once per frame, after the last section ended. Collects the results
+// of the frame whose queries are about to be reused.
+void gpu_timer_next_frame(struct gpu_timer *timer) {
+  if (!timer)
+    return;
+
+  timer->frame = (timer->frame + 1) % GPU_TIMER_LATENCY;
+  for (int i = 0; i < timer->section_count; i++) {
+    struct gpu_timer_section *section = &timer->sections[i];
+    if (!section->recorded[timer->frame])
+      continue;
+    section->recorded[timer->frame] = 0;
+
+    GLuint *queries = section->queries[timer->frame];
+    GLint available = 0;
+    glGetQueryObjectiv(queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      timer->dropped++;
+      continue;
+    }
+
+    GLuint64 begin, end;
+    glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+
+    section->ms = (float) ((double) (end - begin) / 1e6);
+    section->average = section->samples
+                         ? section->average * 0.9f + section->ms * 0.1f
+                         : section->ms;
+    section->samples++;
+  }
+}
+
+// Smoothed time of a section in milliseconds, 0 until it has a result
+float gpu_timer_ms(const struct gpu_timer *timer, const char *name) {
+  if (!timer)
+    return 0.0f;
+
+  for (int i = 0; i < timer->section_count; i++) {
+    if (strcmp(timer->sections[i].name, name) == 0)
+      return timer->sections[i].average;
+  }
+  return 0.0f;
+}
+
+void print_gpu_timer(const struct gpu_timer *timer) {
+  if (!timer)
+    return;
+
+  printf("GPU:");
+  for (int i = 0; i < timer->section_count; i++) {
+    const struct gpu_timer_section *section = &timer->sections[i];
+    printf(" %s %.3f ms", section->name, (double) section->average);
+    if (i + 1 < timer->section_count)
+      printf(",");
+  }
+  if (timer->dropped)
+    printf(" (%d results dropped)", timer->dropped);
+  printf("\n");
+}
+
+void free_gpu_timer(struct gpu_timer *timer) {
+  for (int i = 0; i < timer->section_count; i++)
+    glDeleteQueries(GPU_TIMER_LATENCY * 2, &timer->sections[i].queries[0][0]);
+  memset(timer, 0, sizeof(*timer));
+}
@@ -2,7 +2,9 @@
 #include <stdint.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "../stbi.h"
+#include "bloom.h"
 #include "post_processing.h"
+#include "readback.h"
 
 const char *vertex_shader_source =
     "#version 410 core\n"
@@ -69,6 +71,50 @@ GLuint load_texture(const char *path) {
   return texture;
 }
 
+// What the scene pass draws with
+struct scene {
+  GLuint program, texture, vao;
+  float pos_x, pos_y;
+};
+
+static void draw_scene(struct frame_graph *graph, int pass, void *data) {
+  const struct scene *scene = data;
+  glUseProgram(scene->program);
+  glUniform1f(glGetUniformLocation(scene->program, "pos_x"), scene->pos_x);
+  glUniform1f(glGetUniformLocation(scene->program, "pos_y"), scene->pos_y);
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, scene->texture);
+  glBindVertexArray(scene->vao);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+// A clear, the scene, then the effects. The clear is a pass of its own only
+// to show it getting folded into the scene's when the graph is compiled.
+static void build_frame_graph(struct frame_graph *graph, struct scene *scene) {
+  int depth;
+  int color = begin_post_processing_graph(graph, &depth);
+
+  // #493657
+  set_graph_clear_color(
+      graph,
+      color,
+      0x49 / 255.0f,
+      0x36 / 255.0f,
+      0x57 / 255.0f,
+      1.0f
+  );
+  int clear = add_graph_pass(graph, "clear", NULL, NULL);
+  graph_write(graph, clear, color, 1);
+  graph_write(graph, clear, depth, 1);
+
+  int pass = add_graph_pass(graph, "scene", draw_scene, scene);
+  graph_write(graph, pass, color, 0);
+  graph_write(graph, pass, depth, 0);
+
+  end_post_processing_graph(graph, color);
+}
+
 int main(void) {
   SDL_Init(SDL_INIT_EVERYTHING);
 
@@ -83,7 +129,7 @@ int main(void) {
       SDL_WINDOWPOS_CENTERED,
       640,
       480,
-      SDL_WINDOW_OPENGL | SDL_WINDOW_ALLOW_HIGHDPI
+      SDL_WINDOW_OPENGL | SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE
   );
   SDL_GLContext context = SDL_GL_CreateContext(window);
 
@@ -92,14 +138,6 @@ int main(void) {
     return 0;
   }
 
-  // GL stuff
-  glClearColor(
-      0x49 / 255.0,
-      0x36 / 255.0,
-      0x57 / 255.0,
-      1.0f
-  ); // Set the clear color to #493657
-
   // data is stored as position & color
   float triangle_data[] = {
       0.5f,
@@ -197,11 +235,49 @@ int main(void) {
   GLuint texture = load_texture("picture.png");
   glUniform1i(glGetUniformLocation(program, "sampler"), 0);
 
-  init_post_processing();
+  int drawable_width, drawable_height;
+  SDL_GL_GetDrawableSize(window, &drawable_width, &drawable_height);
+  init_post_processing(drawable_width, drawable_height);
+
+  // Bloom, then the per pixel effects, which end up in one shader. Add more
+  // effects here, they are applied in order. B toggles the bloom, G the
+  // colour grading, V the vignette and P switches between the pixelate
+  // effect and rendering at block resolution, which look about the same.
+  struct bloom bloom;
+  int bloom_effect = add_bloom_effect(&bloom, 5);
+  set_post_effect_enabled(bloom_effect, 0);
+  int grade = add_pixel_effect("grade", NULL, grade_color);
+  set_post_effect_enabled(grade, 0);
+  int pixelate = add_pixel_effect("pixelate", pixelate_uv, NULL);
+  add_pixel_effect("tint", NULL, tint_color);
+  int vignette = add_pixel_effect("vignette", NULL, vignette_color);
+  set_post_effect_enabled(vignette, 0);
+
+  // GPU timings of every pass, printed every couple of seconds. They also
+  // drive the dynamic resolution, which aims for 60 FPS.
+  struct gpu_timer timer;
+  init_gpu_timer(&timer);
+  post_processing_timer = &timer;
+
+  // Built again whenever the sizes or the effects change
+  struct scene scene = {program, texture, vao, 0.0f, 0.0f};
+  struct frame_graph graph;
+  init_frame_graph(&graph, &post_processing_pool);
+  graph.timer = &timer;
+  build_frame_graph(&graph, &scene);
+  print_frame_graph(&graph);
+
+  // F12 saves a screenshot, C starts & stops saving every frame
+  struct readback readback;
+  init_readback(&readback);
+  int screenshot = 0, capturing = 0, shot_count = 0, capture_count = 0;
+  uint64_t last_report = SDL_GetTicks64();
+
+  struct dynamic_resolution resolution;
+  init_dynamic_resolution(&resolution, 1000.0f / 60.0f);
 
   // The funnies
   const uint8_t *keyboard = SDL_GetKeyboardState(NULL);
-  float pos_x = 0.0f, pos_y = 0.0f;
   uint64_t prev = SDL_GetTicks64();
 
   // Main loop
@@ -213,6 +289,67 @@ int main(void) {
         case SDL_QUIT:
           running = SDL_FALSE;
           break;
+        case SDL_WINDOWEVENT:
+          if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+            SDL_GL_GetDrawableSize(window, &drawable_width, &drawable_height);
+            resize_post_processing(drawable_width, drawable_height);
+          }
+          break;
+        // - and = change the render scale, R lets the GPU time pick it
+        case SDL_KEYDOWN:
+          if (event.key.keysym.sym == SDLK_MINUS) {
+            set_post_processing_scale(render_scale - 0.25f);
+          } else if (event.key.keysym.sym == SDLK_EQUALS) {
+            set_post_processing_scale(render_scale + 0.25f);
+          } else if (event.key.keysym.sym == SDLK_b
+                     || event.key.keysym.sym == SDLK_g
+                     || event.key.keysym.sym == SDLK_v) {
+            int index = bloom_effect;
+            if (event.key.keysym.sym == SDLK_g)
+              index = grade;
+            else if (event.key.keysym.sym == SDLK_v)
+              index = vignette;
+            const struct post_effect *effect = &post_chain.effects[index];
+            set_post_effect_enabled(index, !effect->enabled);
+            printf("%s %s\n", effect->name, effect->enabled ? "on" : "off");
+            break;
+          } else if (event.key.keysym.sym == SDLK_p) {
+            const struct post_effect *effect = &post_chain.effects[pixelate];
+            set_post_effect_enabled(pixelate, !effect->enabled);
+            set_post_processing_block_size(effect->enabled ? 1 : 5);
+            printf(
+                "Pixelation at %s resolution\n",
+                effect->enabled ? "full" : "block"
+            );
+            break;
+          } else if (event.key.keysym.sym == SDLK_m) {
+            // 1, 2, 4, 8 samples, back to 1 after 8 or the most the driver
+            // supports
+            int samples = post_processing_samples * 2;
+            set_post_processing_samples(samples > 8 ? 1 : samples);
+            if (post_processing_samples < samples && samples <= 8)
+              set_post_processing_samples(1);
+            printf("MSAA %dx\n", post_processing_samples);
+            break;
+          } else if (event.key.keysym.sym == SDLK_F12) {
+            screenshot = 1;
+            break;
+          } else if (event.key.keysym.sym == SDLK_c) {
+            capturing = !capturing;
+            printf("Capture %s\n", capturing ? "on" : "off");
+            break;
+          } else if (event.key.keysym.sym == SDLK_r) {
+            resolution.enabled = !resolution.enabled;
+            printf(
+                "Dynamic resolution %s\n",
+                resolution.enabled ? "on" : "off"
+            );
+            break;
+          } else {
+            continue;
+          }
+          printf("Render scale %.2f\n", render_scale);
+          break;
         default:
           continue;
       }
@@ -223,33 +360,56 @@ int main(void) {
     prev = curr;
 
     if (keyboard[SDL_SCANCODE_W]) {
-      pos_y += delta;
+      scene.pos_y += delta;
     } else if (keyboard[SDL_SCANCODE_S]) {
-      pos_y -= delta;
+      scene.pos_y -= delta;
     }
 
     if (keyboard[SDL_SCANCODE_D]) {
-      pos_x += delta;
+      scene.pos_x += delta;
     } else if (keyboard[SDL_SCANCODE_A]) {
-      pos_x -= delta;
+      scene.pos_x -= delta;
     }
 
-    post_processing_begin();
-    glClear(GL_COLOR_BUFFER_BIT); // Clear the background with color
-
-    glUniform1f(glGetUniformLocation(program, "pos_x"), pos_x);
-    glUniform1f(glGetUniformLocation(program, "pos_y"), pos_y);
-
-    //glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    if (post_processing_graph_stale(&graph))
+      build_frame_graph(&graph, &scene);
 
     // Rendering
-    glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-
-    post_processing_end();
+    int frame_section = gpu_timer_begin(&timer, "frame");
+    execute_frame_graph(&graph);
+    gpu_timer_end(&timer, frame_section);
+
+    // The back buffer, before it's swapped away
+    if (screenshot || capturing) {
+      char path[64];
+      if (screenshot)
+        snprintf(path, sizeof(path), "screenshot-%d.ppm", shot_count++);
+      else
+        snprintf(path, sizeof(path), "capture-%05d.ppm", capture_count++);
+
+      int section = gpu_timer_begin(&timer, "readback");
+      request_readback(&readback, 0, screen_width, screen_height, path);
+      gpu_timer_end(&timer, section);
+      screenshot = 0;
+    }
 
     SDL_GL_SwapWindow(window); // Swap window buffers
+    gpu_timer_next_frame(&timer);
+    update_readback(&readback);
+    update_dynamic_resolution(&resolution, gpu_timer_ms(&timer, "frame"));
+
+    if (curr - last_report >= 2000) {
+      print_gpu_timer(&timer);
+      print_target_pool(&post_processing_pool);
+      print_readback(&readback);
+      printf(
+          "Render scale %.2f, MSAA %dx\n",
+          render_scale,
+          post_processing_samples
+      );
+      last_report = curr;
+    }
+
     // Delay so that there's at least some time between frames
     SDL_Delay(1);
 
@@ -260,10 +420,17 @@ int main(void) {
     }
   }
 
-  printf("post_processing_shader: %u\n", post_processing_shader);
+  for (int i = 0; i < post_chain.pass_count; i++) {
+    const struct post_pass *pass = &post_chain.passes[i];
+    printf("%s: %u\n", pass->name, pass->program);
+  }
   printf("other program: %u\n", program);
 
+  free_readback(&readback);
+  free_frame_graph(&graph);
+  free_bloom(&bloom);
   post_processing_cleanup();
+  free_gpu_timer(&timer);
 
   // Quit from OpenGL
   glDeleteTextures(1, &texture);
@@ -1,7 +1,15 @@
+#pragma once
+
 #include <glad/glad.h>
+#include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "frame_graph.h"
+#include "gpu_timer.h"
+#include "target_pool.h"
 
 GLuint compile_shader(GLenum shader_type, const char *source) {
   GLuint shader = glCreateShader(shader_type);
@@ -51,17 +59,42 @@ const float screen_verts[] = {1.0f, -1.0f, 1.0f,  0.0f, -1.0f, -1.0f,
 
                               1.0f, 1.0f,  1.0f,  1.0f, 1.0f,  -1.0f,
                               1.0f, 0.0f,  -1.0f, 1.0f, 0.0f,  1.0f};
-#ifdef __APPLE__
-const int screen_width = 640 * 2, screen_height = 480 * 2;
-#else
-const int screen_width = 640, screen_height = 480;
-#endif
+
+// The default framebuffer's size in pixels, and the fraction of it the scene
+// and the effects are rendered at. The last effect scales the result up to
+// the screen. The frame graph is built again at the new size on the next
+// frame (post_processing_graph_stale) rather than for every resize event,
+// the old targets are deleted once they have gone unused for a few frames.
+#define POST_PROCESSING_MIN_SCALE 0.25f
+#define POST_PROCESSING_MAX_SCALE 1.0f
+
+int screen_width, screen_height;
+float render_scale = 1.0f;
+int render_width, render_height; // what the graph was built at
+
+// Pixelation without a pixelate pass: with a block size above 1 the scene
+// and the effects are rendered at 1 / block of the render size, and nearest
+// filtering blows every pixel up into a block on the screen. That's block^2
+// times fewer fragments for the scene than pixelating a full size image.
+int pixel_block_size = 1;
+
+// Samples per pixel for the scene. Above 1 it's drawn into multisampled
+// colour & depth renderbuffers, and a resolve pass blits that down into the
+// texture the effects read, so edges are smoothed before they get there.
+// The scene's pass gets slower with the sample count and the resolve is a
+// pass of its own, both show up in the GPU timings.
+int post_processing_samples = 1;
+int render_samples = 1; // what the graph was built at
+
 GLuint screen_rect_vao, screen_rect_vbo;
-GLuint post_processing_fbo;
-GLuint post_processing_texture;
-GLuint post_processing_shader, program;
 
-GLuint uniform_screen_pos_location;
+// Every texture & renderbuffer the scene and the effects draw into
+struct target_pool post_processing_pool;
+
+GLuint program;
+
+// When set, effects with passes of their own (bloom) time them with it
+struct gpu_timer *post_processing_timer;
 
 const char *post_processing_vertex =
     "#version 410 core\n"
@@ -74,28 +107,385 @@ const char *post_processing_vertex =
     "    out_tex_coords = tex_coords;\n"
     "}\n";
 
-const char *post_processing_fragment =
-    "#version 410 core\n"
-    "out vec4 color;\n"
-    "in vec2 out_tex_coords;\n"
+// Per pixel effects for add_pixel_effect. They are GLSL pieces rather than
+// whole shaders: uv code moves the point the image is read at, colour code
+// changes the colour read there. Both can use `resolution`, the image size
+// in pixels, and colour code also sees `uv`, where the pixel it writes is.
+const char *pixelate_uv =
+    "vec2 block_size = resolution / 5.0;\n"
+    "uv = floor((uv + 0.5) * block_size) / block_size - 0.5;\n";
 
-    "uniform sampler2D screen_texture;\n"
-    "uniform vec2 screen_resolution;"
+// Red channel as grey, tinted blue
+const char *tint_color =
+    "color = vec4(color.x);\n"
+    "color.z += 0.5;\n";
 
-    "void main() {\n"
-    "    vec2 block_size = screen_resolution / 5.0;\n"
-    "    vec2 uv = floor((out_tex_coords + 0.5) * block_size) / block_size - 0.5;\n"
-    "    float color_tmp = texture(screen_texture, uv).x;"
-    "    color = vec4(color_tmp);\n"
-    "    color.z += 0.5;\n"
-    "}\n";
+// A bit more saturation and contrast
+const char *grade_color =
+    "float grey = dot(color.rgb, vec3(0.299, 0.587, 0.114));\n"
+    "color.rgb = mix(vec3(grey), color.rgb, 1.2);\n"
+    "color.rgb = (color.rgb - 0.5) * 1.1 + 0.5;\n";
+
+// Darker towards the corners
+const char *vignette_color =
+    "vec2 from_center = uv - 0.5;\n"
+    "color.rgb *= 1.0 - dot(from_center, from_center) * 1.2;\n";
+
+// The effects are passes of a frame graph (frame_graph.h), after the scene
+// and in the order they were added. Every pass but the last writes a
+// texture at the render size that only the next one reads, so the graph
+// lets any number of them take turns on two textures (the scene's being one
+// of them). The last pass draws to the screen.
+//
+// Effects that read a neighbourhood of pixels (bloom) are whole shaders with
+// a pass of their own. A run of per pixel effects between them is fused into
+// a single generated shader when the chain is built, so it costs one read
+// and one write of the image however many effects are in it. The chain, and
+// with it the graph, is built again after an effect is added or switched on
+// or off.
+#define POST_PROCESSING_MAX_EFFECTS 8
+
+struct post_effect {
+  char name[32];
+  int enabled; // disabled effects are skipped
+
+  // Neighbourhood effects, 0 for per pixel ones
+  GLuint program;
+  GLint resolution_location; // -1 if the shader doesn't use it
+
+  // Per pixel effects, either may be NULL
+  const char *uv_code, *color_code;
+
+  // Optional, runs right before the effect's own pass with the texture it
+  // is going to read. Effects that need more than one pass (see bloom.h) do
+  // their extra work here, and release what they used in finish, which runs
+  // after the pass.
+  void (*prepare)(void *data, GLuint source);
+  void (*finish)(void *data);
+  void *data;
+};
+
+// What the chain is built into, one full screen draw each
+struct post_pass {
+  char name[64]; // the effects in it, joined with +
+  GLuint program;
+  GLint resolution_location;
+  const struct post_effect *effect; // NULL for fused per pixel effects
+  int input;                        // graph resource it reads
+};
+
+struct post_chain {
+  struct post_effect effects[POST_PROCESSING_MAX_EFFECTS];
+  int effect_count;
+
+  struct post_pass passes[POST_PROCESSING_MAX_EFFECTS];
+  int pass_count;
+  int dirty; // passes need building again
+};
+
+struct post_chain post_chain;
+
+static struct post_effect *new_post_effect(const char *name) {
+  if (post_chain.effect_count == POST_PROCESSING_MAX_EFFECTS) {
+    printf("Too many post processing effects, %s is skipped\n", name);
+    return NULL;
+  }
+
+  struct post_effect *effect = &post_chain.effects[post_chain.effect_count];
+  memset(effect, 0, sizeof(*effect));
+  snprintf(effect->name, sizeof(effect->name), "%s", name);
+  effect->resolution_location = -1;
+  effect->enabled = 1;
+  post_chain.dirty = 1;
+  return effect;
+}
+
+// Appends a neighbourhood effect, a whole fragment shader with screen_texture
+// and screen_resolution, to the end of the chain. Returns its index or -1 if
+// the chain is full.
+int add_post_effect(const char *name, const char *fragment_source) {
+  struct post_effect *effect = new_post_effect(name);
+  if (!effect)
+    return -1;
+
+  effect->program = create_shader(post_processing_vertex, fragment_source);
+  effect->resolution_location =
+      glGetUniformLocation(effect->program, "screen_resolution");
+
+  glUseProgram(effect->program);
+  glUniform1i(glGetUniformLocation(effect->program, "screen_texture"), 0);
+
+  return post_chain.effect_count++;
+}
+
+// Appends a per pixel effect made of the GLSL pieces described above, either
+// may be NULL. The strings have to stay around, they are compiled when the
+// chain is built. Returns the effect's index or -1.
+int add_pixel_effect(
+    const char *name,
+    const char *uv_code,
+    const char *color_code
+) {
+  struct post_effect *effect = new_post_effect(name);
+  if (!effect)
+    return -1;
+
+  effect->uv_code = uv_code;
+  effect->color_code = color_code;
+  return post_chain.effect_count++;
+}
+
+void set_post_effect_enabled(int index, int enabled) {
+  if (index < 0 || index >= post_chain.effect_count)
+    return;
+
+  struct post_effect *effect = &post_chain.effects[index];
+  enabled = !!enabled;
+  if (effect->enabled != enabled)
+    post_chain.dirty = 1;
+  effect->enabled = enabled;
+}
+
+struct post_source {
+  char *text;
+  size_t length, capacity;
+};
+
+static void post_source_append(struct post_source *source, const char *text) {
+  size_t length = strlen(text);
+  if (source->length + length + 1 > source->capacity) {
+    while (source->length + length + 1 > source->capacity)
+      source->capacity = source->capacity ? source->capacity * 2 : 1024;
+    source->text = realloc(source->text, source->capacity);
+  }
+  memcpy(source->text + source->length, text, length + 1);
+  source->length += length;
+}
+
+// One shader for the enabled per pixel effects in first..end. Each effect
+// reads the image at its remapped uv, so going backwards from the pixel
+// being written the uv code of the last effect runs first, and the texture
+// is read once at the end of all of them. The colour code then runs in
+// order, every effect seeing the uv of the pixel it would have written.
+static GLuint fuse_pixel_effects(int first, int end) {
+  struct post_source source = {0};
+  char line[64];
+
+  post_source_append(
+      &source,
+      "#version 410 core\n"
+      "out vec4 color;\n"
+      "in vec2 out_tex_coords;\n"
+
+      "uniform sampler2D screen_texture;\n"
+      "uniform vec2 screen_resolution;\n"
+
+      "void main() {\n"
+      "vec2 resolution = screen_resolution;\n"
+      "vec2 uv = out_tex_coords;\n"
+  );
+
+  for (int i = end - 1; i >= first; i--) {
+    const struct post_effect *effect = &post_chain.effects[i];
+    if (!effect->enabled)
+      continue;
+
+    snprintf(line, sizeof(line), "vec2 uv_%d = uv;\n", i);
+    post_source_append(&source, line);
+    if (effect->uv_code) {
+      post_source_append(&source, "{\n");
+      post_source_append(&source, effect->uv_code);
+      post_source_append(&source, "}\n");
+    }
+  }
+
+  post_source_append(&source, "color = texture(screen_texture, uv);\n");
+
+  for (int i = first; i < end; i++) {
+    const struct post_effect *effect = &post_chain.effects[i];
+    if (!effect->enabled || !effect->color_code)
+      continue;
+
+    snprintf(line, sizeof(line), "{\nvec2 uv = uv_%d;\n", i);
+    post_source_append(&source, line);
+    post_source_append(&source, effect->color_code);
+    post_source_append(&source, "}\n");
+  }
+  post_source_append(&source, "}\n");
+
+  GLuint program = create_shader(post_processing_vertex, source.text);
+  free(source.text);
+
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "screen_texture"), 0);
+  return program;
+}
+
+// Turns the enabled effects into passes, fusing runs of per pixel effects
+static void build_post_chain(void) {
+  for (int i = 0; i < post_chain.pass_count; i++) {
+    if (!post_chain.passes[i].effect)
+      glDeleteProgram(post_chain.passes[i].program);
+  }
+  post_chain.pass_count = 0;
+
+  int i = 0;
+  while (i < post_chain.effect_count) {
+    const struct post_effect *effect = &post_chain.effects[i];
+    if (!effect->enabled) {
+      i++;
+      continue;
+    }
+
+    struct post_pass *pass = &post_chain.passes[post_chain.pass_count++];
+    if (effect->program) {
+      // Both live in post_chain, snprintf can't be told they don't overlap
+      memcpy(pass->name, effect->name, sizeof(effect->name));
+      pass->program = effect->program;
+      pass->resolution_location = effect->resolution_location;
+      pass->effect = effect;
+      i++;
+      continue;
+    }
+
+    // Disabled effects don't break a run, they aren't there
+    int first = i;
+    while (i < post_chain.effect_count) {
+      const struct post_effect *next = &post_chain.effects[i];
+      if (next->program && next->enabled)
+        break;
+      i++;
+    }
+
+    pass->name[0] = '\0';
+    for (int k = first; k < i; k++) {
+      const struct post_effect *fused = &post_chain.effects[k];
+      if (!fused->enabled || fused->program)
+        continue;
+      size_t length = strlen(pass->name);
+      snprintf(
+          pass->name + length,
+          sizeof(pass->name) - length,
+          "%s%s",
+          length ? "+" : "",
+          fused->name
+      );
+    }
+    pass->program = fuse_pixel_effects(first, i);
+    pass->resolution_location =
+        glGetUniformLocation(pass->program, "screen_resolution");
+    pass->effect = NULL;
+  }
+
+  post_chain.dirty = 0;
+}
+
+static void post_processing_render_size(int *width, int *height) {
+  *width = (int) (screen_width * render_scale + 0.5f);
+  *height = (int) (screen_height * render_scale + 0.5f);
+
+  // Partial blocks at the edges still get a pixel
+  *width = (*width + pixel_block_size - 1) / pixel_block_size;
+  *height = (*height + pixel_block_size - 1) / pixel_block_size;
+  if (*width < 1)
+    *width = 1;
+  if (*height < 1)
+    *height = 1;
+}
+
+// Call when the drawable size changes, the targets follow on the next frame
+void resize_post_processing(int width, int height) {
+  screen_width = width > 0 ? width : 1;
+  screen_height = height > 0 ? height : 1;
+}
+
+// Fraction of the screen resolution to render at, clamped to
+// POST_PROCESSING_MIN_SCALE..POST_PROCESSING_MAX_SCALE
+void set_post_processing_scale(float scale) {
+  if (scale < POST_PROCESSING_MIN_SCALE)
+    scale = POST_PROCESSING_MIN_SCALE;
+  if (scale > POST_PROCESSING_MAX_SCALE)
+    scale = POST_PROCESSING_MAX_SCALE;
+  render_scale = scale;
+}
+
+// Dynamic resolution: watches how long the GPU takes per frame and moves
+// the render scale so the frame fits in a budget. The cost of a frame mostly
+// grows with its pixel count, the square of the scale, so the square root
+// of budget / time says how far to go. Changes are made in steps and then
+// held for a while, the timings lag a few frames behind and reallocating the
+// targets every frame would cost more than it saves.
+#define DYNAMIC_RESOLUTION_STEP 0.05f
+#define DYNAMIC_RESOLUTION_HOLD_FRAMES 30
+
+struct dynamic_resolution {
+  int enabled;
+  float budget_ms;
+  float min_scale, max_scale;
+  int hold; // frames until the scale may change again
+};
+
+void init_dynamic_resolution(
+    struct dynamic_resolution *resolution,
+    float budget_ms
+) {
+  resolution->enabled = 0;
+  resolution->budget_ms = budget_ms;
+  resolution->min_scale = 0.5f;
+  resolution->max_scale = 1.0f;
+  resolution->hold = 0;
+}
+
+// Feed it the GPU time of a whole frame, once per frame
+void update_dynamic_resolution(
+    struct dynamic_resolution *resolution,
+    float gpu_ms
+) {
+  if (!resolution->enabled || gpu_ms <= 0.0f)
+    return;
+  if (resolution->hold > 0) {
+    resolution->hold--;
+    return;
+  }
+
+  // Aim a little under the budget so a slightly heavier frame still fits
+  float scale = render_scale * sqrtf(resolution->budget_ms * 0.9f / gpu_ms);
+  scale = roundf(scale / DYNAMIC_RESOLUTION_STEP) * DYNAMIC_RESOLUTION_STEP;
+  if (scale < resolution->min_scale)
+    scale = resolution->min_scale;
+  if (scale > resolution->max_scale)
+    scale = resolution->max_scale;
+
+  if (fabsf(scale - render_scale) < DYNAMIC_RESOLUTION_STEP * 0.5f)
+    return;
+
+  set_post_processing_scale(scale);
+  resolution->hold = DYNAMIC_RESOLUTION_HOLD_FRAMES;
+}
+
+// Clamped to what the driver supports, 1 turns multisampling off
+void set_post_processing_samples(int samples) {
+  GLint max_samples = 1;
+  glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+  if (samples > max_samples)
+    samples = max_samples;
+  post_processing_samples = samples > 1 ? samples : 1;
+}
+
+// Size of the blocks on the screen in pixels, 1 turns pixelation off
+void set_post_processing_block_size(int size) {
+  pixel_block_size = size > 1 ? size : 1;
+}
+
+// width & height are the drawable size of the window in pixels
+void init_post_processing(int width, int height) {
+  resize_post_processing(width, height);
+  post_processing_render_size(&render_width, &render_height);
 
-void init_post_processing(void) {
-  unsigned int rect_vbo;
   glGenVertexArrays(1, &screen_rect_vao);
-  glGenBuffers(1, &rect_vbo);
+  glGenBuffers(1, &screen_rect_vbo);
   glBindVertexArray(screen_rect_vao);
-  glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, screen_rect_vbo);
   glBufferData(
       GL_ARRAY_BUFFER,
       sizeof(screen_verts),
@@ -121,93 +511,158 @@ void init_post_processing(void) {
       (void *) (2 * sizeof(float))
   );
 
-  // Create Frame Buffer Object
-  glGenFramebuffers(1, &post_processing_fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, post_processing_fbo);
+  init_target_pool(&post_processing_pool);
+  memset(&post_chain, 0, sizeof(post_chain));
+}
+
+// Execute callback of an effect's pass, data is its post_pass
+static void run_post_pass(struct frame_graph *graph, int index, void *data) {
+  const struct post_pass *pass = data;
+  const struct post_effect *effect = pass->effect;
+  GLuint source = graph_resource_texture(graph, pass->input);
+
+  if (effect && effect->prepare) {
+    effect->prepare(effect->data, source);
+    bind_graph_pass(graph, index);
+  }
+
+  glBindVertexArray(screen_rect_vao);
+  glActiveTexture(GL_TEXTURE0);
+  glUseProgram(pass->program);
+  if (pass->resolution_location >= 0)
+    glUniform2f(pass->resolution_location, render_width, render_height);
+  glBindTexture(GL_TEXTURE_2D, source);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+
+  if (effect && effect->finish)
+    effect->finish(effect->data);
+}
 
-  // Create Framebuffer Texture
-  glGenTextures(1, &post_processing_texture);
-  glBindTexture(GL_TEXTURE_2D, post_processing_texture);
-  glTexImage2D(
-      GL_TEXTURE_2D,
+// Without any effects the scene is only scaled up to the screen
+static void blit_post_pass(struct frame_graph *graph, int index, void *data) {
+  const int *source = data;
+  int target = graph->resources[*source].target;
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, graph->pool->targets[target].fbo);
+  glBlitFramebuffer(
+      0,
+      0,
+      render_width,
+      render_height,
+      0,
       0,
-      GL_RGB,
       screen_width,
       screen_height,
-      0,
-      GL_RGB,
-      GL_UNSIGNED_BYTE,
-      NULL
-  );
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(
-      GL_TEXTURE_2D,
-      GL_TEXTURE_WRAP_S,
-      GL_CLAMP_TO_EDGE
-  ); // Prevents edge bleeding
-  glTexParameteri(
-      GL_TEXTURE_2D,
-      GL_TEXTURE_WRAP_T,
-      GL_CLAMP_TO_EDGE
-  ); // Prevents edge bleeding
-  glFramebufferTexture2D(
-      GL_FRAMEBUFFER,
-      GL_COLOR_ATTACHMENT0,
-      GL_TEXTURE_2D,
-      post_processing_texture,
-      0
+      GL_COLOR_BUFFER_BIT,
+      GL_NEAREST
   );
+}
+
+// Starts a frame graph at the current render size with the scene's targets
+// declared, returns the colour and puts the depth in *depth. The scene's
+// passes go in between this and end_post_processing_graph.
+int begin_post_processing_graph(struct frame_graph *graph, int *depth) {
+  post_processing_render_size(&render_width, &render_height);
+  render_samples = post_processing_samples;
+  reset_frame_graph(graph, screen_width, screen_height);
 
-  GLuint rbo;
-  glGenRenderbuffers(1, &rbo);
-  glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-  glRenderbufferStorage(
-      GL_RENDERBUFFER,
+  if (render_samples > 1) {
+    *depth = graph_multisample_renderbuffer(
+        graph,
+        "scene depth",
+        GL_DEPTH24_STENCIL8,
+        render_samples,
+        render_width,
+        render_height
+    );
+    return graph_multisample_renderbuffer(
+        graph,
+        "scene msaa",
+        GL_RGB8,
+        render_samples,
+        render_width,
+        render_height
+    );
+  }
+
+  *depth = graph_renderbuffer(
+      graph,
+      "scene depth",
       GL_DEPTH24_STENCIL8,
-      screen_width,
-      screen_height
-  );
-  glFramebufferRenderbuffer(
-      GL_FRAMEBUFFER,
-      GL_DEPTH_STENCIL_ATTACHMENT,
-      GL_RENDERBUFFER,
-      rbo
+      render_width,
+      render_height
   );
+  return graph_texture(graph, "scene", GL_RGB8, render_width, render_height);
+}
 
-  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-    printf("uh oh cannot create the buffer :(\n");
-    exit(1);
+// Adds the effects, from source to the screen, and compiles the graph
+void end_post_processing_graph(struct frame_graph *graph, int source) {
+  static int blit_source;
+
+  if (post_chain.dirty)
+    build_post_chain();
+
+  if (graph->resources[source].samples > 1) {
+    int resolved =
+        graph_texture(graph, "scene", GL_RGB8, render_width, render_height);
+    add_graph_resolve_pass(graph, "resolve", source, resolved);
+    source = resolved;
   }
 
-  post_processing_shader =
-      create_shader(post_processing_vertex, post_processing_fragment);
+  if (post_chain.pass_count == 0) {
+    blit_source = source;
+    int pass = add_graph_pass(graph, "blit", blit_post_pass, &blit_source);
+    graph_read(graph, pass, source);
+    graph_write(graph, pass, FRAME_GRAPH_SCREEN, 0);
+  }
 
-  uniform_screen_pos_location =
-      glGetUniformLocation(post_processing_shader, "screen_resolution");
-}
+  for (int i = 0; i < post_chain.pass_count; i++) {
+    struct post_pass *pass = &post_chain.passes[i];
+    int output = FRAME_GRAPH_SCREEN;
+    if (i + 1 < post_chain.pass_count) {
+      output = graph_texture(
+          graph,
+          pass->name,
+          GL_RGB8,
+          render_width,
+          render_height
+      );
+    }
 
-void post_processing_begin(void) {
-  glBindFramebuffer(GL_FRAMEBUFFER, post_processing_fbo);
-  //glEnable(GL_DEPTH_TEST);
-  glUseProgram(program);
-}
+    pass->input = source;
+    int index = add_graph_pass(graph, pass->name, run_post_pass, pass);
+    graph_read(graph, index, source);
+    graph_write(graph, index, output, 0);
+    source = output;
+  }
 
-void post_processing_end(void) {
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glUseProgram(post_processing_shader);
+  if (!compile_frame_graph(graph))
+    exit(1);
+}
 
-  glUniform2f(uniform_screen_pos_location, screen_width, screen_height);
+// Whether the graph has to be built again, for a new size, sample count or
+// new effects
+int post_processing_graph_stale(const struct frame_graph *graph) {
+  int width, height;
+  post_processing_render_size(&width, &height);
 
-  glBindVertexArray(screen_rect_vao);
-  //glDisable(GL_DEPTH_TEST);
-  glBindTexture(GL_TEXTURE_2D, post_processing_texture);
-  glDrawArrays(GL_TRIANGLES, 0, 6);
+  const struct graph_resource *screen = &graph->resources[FRAME_GRAPH_SCREEN];
+  return !graph->compiled || post_chain.dirty || width != render_width
+      || height != render_height || screen->width != screen_width
+      || screen->height != screen_height
+      || post_processing_samples != render_samples;
 }
 
 void post_processing_cleanup(void) {
   glDeleteBuffers(1, &screen_rect_vbo);
   glDeleteVertexArrays(1, &screen_rect_vao);
-  glDeleteProgram(post_processing_shader);
-  glDeleteTextures(1, &post_processing_texture);
+  free_target_pool(&post_processing_pool);
+
+  for (int i = 0; i < post_chain.effect_count; i++)
+    glDeleteProgram(post_chain.effects[i].program);
+  for (int i = 0; i < post_chain.pass_count; i++) {
+    if (!post_chain.passes[i].effect)
+      glDeleteProgram(post_chain.passes[i].program);
+  }
+  memset(&post_chain, 0, sizeof(post_chain));
 }
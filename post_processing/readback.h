@@ -0,0 +1,245 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <glad/glad.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Reads frames back without waiting for the GPU. glReadPixels into a pixel
+// pack buffer only queues a copy, a fence marks when it's done, and the
+// buffer is mapped READBACK_DELAY frames later, when the copy is long
+// finished and mapping doesn't stall. The pixels are copied out (the buffer
+// has to be unmapped on the GL thread) and a writer thread turns them into
+// PPM files, so the frame never waits for the disk either.
+//
+// If every buffer is still in flight or the writer falls behind, requests
+// are dropped and counted rather than waited for.
+//
+//   request_readback(&readback, 0, width, height, "shot.ppm");
+//   SDL_GL_SwapWindow(window);
+//   update_readback(&readback);
+
+#define READBACK_SLOTS 4 // readbacks in flight
+#define READBACK_DELAY 2 // frames before a readback is mapped
+#define READBACK_QUEUE 8 // images waiting for the writer
+
+struct readback_slot {
+  GLuint pbo;
+  size_t size;  // what the buffer has room for
+  GLsync fence; // while the copy is in flight
+  int width, height;
+  int frame; // the one it was requested in
+  char path[64];
+};
+
+struct readback_image {
+  unsigned char *pixels; // RGB rows, bottom first like GL has them
+  int width, height;
+  char path[64];
+};
+
+struct readback {
+  struct readback_slot slots[READBACK_SLOTS];
+  int next_slot; // the oldest one too, they're used in turn
+  int frame;
+
+  // Shared with the writer thread
+  SDL_mutex *mutex;
+  SDL_cond *wake;
+  SDL_Thread *thread;
+  struct readback_image queue[READBACK_QUEUE];
+  int queue_head, queue_count;
+  int quit;
+
+  int written; // by the writer
+  int dropped; // ring or queue was full
+};
+
+static void readback_write_ppm(const struct readback_image *image) {
+  FILE *file = fopen(image->path, "wb");
+  if (!file) {
+    printf("Cannot write %s\n", image->path);
+    return;
+  }
+
+  fprintf(file, "P6\n%d %d\n255\n", image->width, image->height);
+  size_t row = (size_t) image->width * 3;
+  for (int y = image->height - 1; y >= 0; y--)
+    fwrite(image->pixels + row * (size_t) y, 1, row, file);
+  fclose(file);
+}
+
+static int readback_writer(void *data) {
+  struct readback *readback = data;
+
+  SDL_LockMutex(readback->mutex);
+  for (;;) {
+    while (readback->queue_count == 0 && !readback->quit)
+      SDL_CondWait(readback->wake, readback->mutex);
+    if (readback->queue_count == 0)
+      break; // quitting with nothing left to write
+
+    struct readback_image image = readback->queue[readback->queue_head];
+    readback->queue_head = (readback->queue_head + 1) % READBACK_QUEUE;
+    readback->queue_count--;
+    SDL_UnlockMutex(readback->mutex);
+
+    readback_write_ppm(&image);
+    free(image.pixels);
+
+    SDL_LockMutex(readback->mutex);
+    readback->written++;
+  }
+  SDL_UnlockMutex(readback->mutex);
+
+  return 0;
+}
+
+void init_readback(struct readback *readback) {
+  memset(readback, 0, sizeof(*readback));
+  for (int i = 0; i < READBACK_SLOTS; i++)
+    glGenBuffers(1, &readback->slots[i].pbo);
+
+  readback->mutex = SDL_CreateMutex();
+  readback->wake = SDL_CreateCond();
+  readback->thread =
+      SDL_CreateThread(readback_writer, "readback writer", readback);
+}
+
+// Queues a copy of the colour of framebuffer (0 for the back buffer) into
+// a PPM file at path. Returns 0 if it had to be dropped.
+int request_readback(
+    struct readback *readback,
+    GLuint framebuffer,
+    int width,
+    int height,
+    const char *path
+) {
+  struct readback_slot *slot = &readback->slots[readback->next_slot];
+  if (slot->fence) {
+    readback->dropped++;
+    return 0;
+  }
+  readback->next_slot = (readback->next_slot + 1) % READBACK_SLOTS;
+
+  slot->width = width;
+  slot->height = height;
+  slot->frame = readback->frame;
+  snprintf(slot->path, sizeof(slot->path), "%s", path);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+  size_t size = (size_t) width * (size_t) height * 3;
+  if (size != slot->size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    slot->size = size;
+  }
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+  glReadBuffer(framebuffer ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  return 1;
+}
+
+// Maps a finished slot and hands the pixels to the writer
+static void readback_collect(
+    struct readback *readback,
+    struct readback_slot *slot
+) {
+  glDeleteSync(slot->fence);
+  slot->fence = NULL;
+
+  SDL_LockMutex(readback->mutex);
+  int full = readback->queue_count == READBACK_QUEUE;
+  SDL_UnlockMutex(readback->mutex);
+  if (full) {
+    readback->dropped++;
+    return;
+  }
+
+  struct readback_image image = {0};
+  image.width = slot->width;
+  image.height = slot->height;
+  snprintf(image.path, sizeof(image.path), "%s", slot->path);
+  image.pixels = malloc(slot->size);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+  void *pixels =
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot->size, GL_MAP_READ_BIT);
+  if (pixels)
+    memcpy(image.pixels, pixels, slot->size);
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  if (!pixels) {
+    free(image.pixels);
+    readback->dropped++;
+    return;
+  }
+
+  SDL_LockMutex(readback->mutex);
+  int tail = (readback->queue_head + readback->queue_count) % READBACK_QUEUE;
+  readback->queue[tail] = image;
+  readback->queue_count++;
+  SDL_CondSignal(readback->wake);
+  SDL_UnlockMutex(readback->mutex);
+}
+
+// Call once per frame, after swapping. Collects the readbacks that are old
+// enough and done, oldest first.
+void update_readback(struct readback *readback) {
+  readback->frame++;
+  for (int i = 0; i < READBACK_SLOTS; i++) {
+    int index = (readback->next_slot + i) % READBACK_SLOTS;
+    struct readback_slot *slot = &readback->slots[index];
+    if (!slot->fence || readback->frame - slot->frame < READBACK_DELAY)
+      continue;
+
+    GLenum status = glClientWaitSync(slot->fence, 0, 0);
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+      readback_collect(readback, slot);
+  }
+}
+
+void print_readback(struct readback *readback) {
+  SDL_LockMutex(readback->mutex);
+  int written = readback->written, waiting = readback->queue_count;
+  SDL_UnlockMutex(readback->mutex);
+  printf(
+      "Readback: %d written, %d waiting, %d dropped\n",
+      written,
+      waiting,
+      readback->dropped
+  );
+}
+
+// Waits for everything requested to be written, then stops the writer
+void free_readback(struct readback *readback) {
+  for (int i = 0; i < READBACK_SLOTS; i++) {
+    int index = (readback->next_slot + i) % READBACK_SLOTS;
+    struct readback_slot *slot = &readback->slots[index];
+    if (!slot->fence)
+      continue;
+
+    // Shutting down, blocking is fine now
+    glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    readback_collect(readback, slot);
+  }
+
+  SDL_LockMutex(readback->mutex);
+  readback->quit = 1;
+  SDL_CondSignal(readback->wake);
+  SDL_UnlockMutex(readback->mutex);
+  SDL_WaitThread(readback->thread, NULL);
+
+  for (int i = 0; i < READBACK_SLOTS; i++)
+    glDeleteBuffers(1, &readback->slots[i].pbo);
+  SDL_DestroyCond(readback->wake);
+  SDL_DestroyMutex(readback->mutex);
+  memset(readback, 0, sizeof(*readback));
+}
@@ -0,0 +1,283 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// Render targets handed out by format and size. A pass acquires what it
+// writes and releases it once the last reader is done, and the next pass
+// asking for the same format and size gets the same texture back, so
+// passes that don't overlap share memory instead of each keeping their own
+// targets. Every target remembers who holds it, releasing one twice or
+// keeping one past free_target_pool is reported.
+//
+// Targets nobody asked for in TARGET_POOL_KEEP_FRAMES frames are deleted,
+// which is how the old sizes go away after a resize.
+//
+//   int color = acquire_texture(&pool, GL_RGB8, width, height, "blur");
+//   glBindFramebuffer(GL_FRAMEBUFFER, pool.targets[color].fbo);
+//   ...
+//   release_target(&pool, color);
+//   ...
+//   target_pool_next_frame(&pool);
+
+#define TARGET_POOL_MAX_TARGETS 32
+#define TARGET_POOL_KEEP_FRAMES 8
+
+struct pooled_target {
+  GLuint handle; // texture or renderbuffer, 0 if the slot is empty
+  GLuint fbo;    // textures only, with the texture as its colour
+  int renderbuffer;
+  GLenum format;
+  int width, height;
+  int samples; // above 1 for multisampled renderbuffers
+  size_t bytes;
+
+  char owner[32]; // empty when free
+  int last_used;  // frame it was last acquired in
+};
+
+struct target_pool {
+  struct pooled_target targets[TARGET_POOL_MAX_TARGETS];
+  int frame;
+  size_t bytes; // everything allocated, free targets included
+  int created, reused;
+};
+
+void init_target_pool(struct target_pool *pool) {
+  memset(pool, 0, sizeof(*pool));
+}
+
+// Roughly what a texel costs, drivers pad 3 channel formats to 4
+static size_t target_format_bytes(GLenum format) {
+  switch (format) {
+    case GL_R8:
+      return 1;
+    case GL_RG8:
+    case GL_R16F:
+      return 2;
+    case GL_RGBA16F:
+    case GL_RGB16F:
+    case GL_RG32F:
+      return 8;
+    case GL_RGBA32F:
+    case GL_RGB32F:
+      return 16;
+    default: // 8 bit RGB(A), R11F_G11F_B10F, depth & stencil
+      return 4;
+  }
+}
+
+static void target_pool_allocate(struct pooled_target *target) {
+  if (target->renderbuffer) {
+    glGenRenderbuffers(1, &target->handle);
+    glBindRenderbuffer(GL_RENDERBUFFER, target->handle);
+    glRenderbufferStorageMultisample(
+        GL_RENDERBUFFER,
+        target->samples > 1 ? target->samples : 0,
+        target->format,
+        target->width,
+        target->height
+    );
+    return;
+  }
+
+  // Only the internal format matters without data, but the rest still has
+  // to be a valid combination for it
+  GLenum format = GL_RGBA, type = GL_UNSIGNED_BYTE;
+  if (target->format == GL_DEPTH24_STENCIL8) {
+    format = GL_DEPTH_STENCIL;
+    type = GL_UNSIGNED_INT_24_8;
+  } else if (target->format == GL_DEPTH_COMPONENT24
+             || target->format == GL_DEPTH_COMPONENT32F) {
+    format = GL_DEPTH_COMPONENT;
+    type = GL_FLOAT;
+  }
+
+  glGenTextures(1, &target->handle);
+  glBindTexture(GL_TEXTURE_2D, target->handle);
+  glTexImage2D(
+      GL_TEXTURE_2D,
+      0,
+      target->format,
+      target->width,
+      target->height,
+      0,
+      format,
+      type,
+      NULL
+  );
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  if (format != GL_RGBA)
+    return;
+
+  glGenFramebuffers(1, &target->fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+  glFramebufferTexture2D(
+      GL_FRAMEBUFFER,
+      GL_COLOR_ATTACHMENT0,
+      GL_TEXTURE_2D,
+      target->handle,
+      0
+  );
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    printf("Render target %s is not renderable\n", target->owner);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+static void target_pool_delete(
+    struct target_pool *pool,
+    struct pooled_target *target
+) {
+  if (target->renderbuffer) {
+    glDeleteRenderbuffers(1, &target->handle);
+  } else {
+    glDeleteTextures(1, &target->handle);
+    glDeleteFramebuffers(1, &target->fbo);
+  }
+  pool->bytes -= target->bytes;
+  memset(target, 0, sizeof(*target));
+}
+
+static int target_pool_acquire(
+    struct target_pool *pool,
+    int renderbuffer,
+    GLenum format,
+    int samples,
+    int width,
+    int height,
+    const char *owner
+) {
+  int empty = -1;
+  for (int i = 0; i < TARGET_POOL_MAX_TARGETS; i++) {
+    struct pooled_target *target = &pool->targets[i];
+    if (!target->handle) {
+      if (empty < 0)
+        empty = i;
+      continue;
+    }
+
+    if (target->owner[0] || target->renderbuffer != renderbuffer
+        || target->format != format || target->samples != samples
+        || target->width != width || target->height != height)
+      continue;
+
+    snprintf(target->owner, sizeof(target->owner), "%s", owner);
+    target->last_used = pool->frame;
+    pool->reused++;
+    return i;
+  }
+
+  if (empty < 0) {
+    printf("Out of render targets, %s gets none\n", owner);
+    return -1;
+  }
+
+  struct pooled_target *target = &pool->targets[empty];
+  target->renderbuffer = renderbuffer;
+  target->format = format;
+  target->samples = samples;
+  target->width = width;
+  target->height = height;
+  target->bytes = (size_t) width * (size_t) height;
+  target->bytes *= target_format_bytes(format) * (size_t) samples;
+  snprintf(target->owner, sizeof(target->owner), "%s", owner);
+  target->last_used = pool->frame;
+  target_pool_allocate(target);
+
+  pool->bytes += target->bytes;
+  pool->created++;
+  return empty;
+}
+
+// A free texture of that format and size, made if there isn't one. Colour
+// textures come with a framebuffer. Returns the target's index or -1.
+int acquire_texture(
+    struct target_pool *pool,
+    GLenum format,
+    int width,
+    int height,
+    const char *owner
+) {
+  return target_pool_acquire(pool, 0, format, 1, width, height, owner);
+}
+
+int acquire_renderbuffer(
+    struct target_pool *pool,
+    GLenum format,
+    int width,
+    int height,
+    const char *owner
+) {
+  return target_pool_acquire(pool, 1, format, 1, width, height, owner);
+}
+
+// samples per pixel, the driver may round it up
+int acquire_multisample_renderbuffer(
+    struct target_pool *pool,
+    GLenum format,
+    int samples,
+    int width,
+    int height,
+    const char *owner
+) {
+  return target_pool_acquire(pool, 1, format, samples, width, height, owner);
+}
+
+// Hands a target back, its contents may be overwritten by the next owner
+void release_target(struct target_pool *pool, int index) {
+  if (index < 0)
+    return;
+
+  struct pooled_target *target = &pool->targets[index];
+  if (!target->owner[0]) {
+    printf("Render target %d was released twice\n", index);
+    return;
+  }
+  target->owner[0] = '\0';
+}
+
+// Call once per frame, deletes the targets that went unused for a while
+void target_pool_next_frame(struct target_pool *pool) {
+  pool->frame++;
+  for (int i = 0; i < TARGET_POOL_MAX_TARGETS; i++) {
+    struct pooled_target *target = &pool->targets[i];
+    if (target->handle && !target->owner[0]
+        && pool->frame - target->last_used > TARGET_POOL_KEEP_FRAMES)
+      target_pool_delete(pool, target);
+  }
+}
+
+void print_target_pool(const struct target_pool *pool) {
+  int count = 0, owned = 0;
+  for (int i = 0; i < TARGET_POOL_MAX_TARGETS; i++) {
+    count += pool->targets[i].handle != 0;
+    owned += pool->targets[i].owner[0] != '\0';
+  }
+
+  printf(
+      "Render targets: %d (%d in use), %.2f MiB, %d created, %d reused\n",
+      count,
+      owned,
+      (double) pool->bytes / (1024.0 * 1024.0),
+      pool->created,
+      pool->reused
+  );
+}
+
+void free_target_pool(struct target_pool *pool) {
+  for (int i = 0; i < TARGET_POOL_MAX_TARGETS; i++) {
+    struct pooled_target *target = &pool->targets[i];
+    if (!target->handle)
+      continue;
+    if (target->owner[0])
+      printf("Render target %d is still held by %s\n", i, target->owner);
+    target_pool_delete(pool, target);
+  }
+  memset(pool, 0, sizeof(*pool));
+}
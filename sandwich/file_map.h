@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+// Maps a whole file read-only, returns NULL if it can't be opened.
+// Windows doesn't get mmap here, the file is just read into memory instead.
+void *map_file(const char *path, size_t *size) {
+#ifdef _WIN32
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  void *data = malloc(length > 0 ? length : 1);
+  if (length < 0 || fread(data, 1, length, file) != (size_t) length) {
+    free(data);
+    fclose(file);
+    return NULL;
+  }
+
+  fclose(file);
+  *size = length;
+  return data;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping stays valid after closing the descriptor
+  if (data == MAP_FAILED)
+    return NULL;
+
+  *size = info.st_size;
+  return data;
+#endif
+}
+
+void unmap_file(void *data, size_t size) {
+#ifdef _WIN32
+  (void) size;
+  free(data);
+#else
+  munmap(data, size);
+#endif
+}
@@ -0,0 +1,450 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file_map.h"
+#include "mesh_optimize.h"
+#include "mesh_simplify.h"
+#include "meshlets.h"
+#include "scene_import.h"
+#include "vertex_format.h"
+
+// Cooked mesh file, written after the first import so warm starts can skip
+// assimp entirely. Layout:
+//
+//   header | vertex blob | index blob | submesh table | material table |
+//   meshlet table
+//
+// Every blob starts on a MESH_CACHE_ALIGNMENT boundary so the mapped
+// vertex/index data can be handed straight to glBufferData.
+
+#define MESH_CACHE_MAGIC "SWMESH\0"
+#define MESH_CACHE_VERSION 5
+#define MESH_CACHE_ALIGNMENT 64
+
+struct mesh_cache_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t vertex_stride; // in bytes
+  uint32_t index_size;    // 2 or 4 bytes
+  uint32_t padding;
+  uint64_t source_hash; // FNV-1a of the source model file
+  uint64_t source_size;
+
+  uint64_t vertex_count, index_count;
+  uint32_t submesh_count, material_count;
+
+  uint64_t vertex_offset, index_offset, submesh_offset, material_offset;
+  uint64_t meshlet_count, meshlet_offset;
+};
+
+struct mesh_cache_submesh {
+  int32_t base_vertex;
+  uint32_t first_index;
+  uint32_t index_count;
+  uint32_t material;
+  float bounds_min[3], bounds_max[3];
+
+  uint32_t lod_count;
+  struct {
+    uint32_t first_index, index_count;
+    float error;
+  } lods[SCENE_MAX_LODS];
+
+  uint32_t first_meshlet, meshlet_count;
+};
+
+struct mesh_cache_material {
+  char texture_path[256];
+};
+
+static uint64_t mesh_cache_align(uint64_t offset) {
+  const uint64_t mask = MESH_CACHE_ALIGNMENT - 1;
+  return (offset + mask) & ~mask;
+}
+
+// 64-bit FNV-1a over the whole file, returns 0 if it can't be read
+uint64_t hash_file(const char *path, uint64_t *size) {
+  size_t length;
+  const unsigned char *data = map_file(path, &length);
+  if (!data)
+    return 0;
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001b3ull;
+  }
+
+  unmap_file((void *) data, length);
+  *size = length;
+  return hash;
+}
+
+// Whether count elements of stride bytes at offset fit in a file of size
+// bytes, without overflowing on the way. Every section is aligned.
+static int mesh_cache_section_fits(
+    uint64_t offset,
+    uint64_t count,
+    uint64_t stride,
+    size_t size
+) {
+  if (offset % MESH_CACHE_ALIGNMENT != 0 || offset > size)
+    return 0;
+  return count <= (size - offset) / stride;
+}
+
+// Whether [first, first + count) lies within total elements
+static int mesh_cache_range_fits(
+    uint64_t first,
+    uint64_t count,
+    uint64_t total
+) {
+  return first <= total && count <= total - first;
+}
+
+static int mesh_cache_header_valid(
+    const struct mesh_cache_header *header,
+    size_t size
+) {
+  return mesh_cache_section_fits(
+             header->vertex_offset,
+             header->vertex_count,
+             header->vertex_stride,
+             size
+         )
+      && mesh_cache_section_fits(
+             header->index_offset,
+             header->index_count,
+             header->index_size,
+             size
+         )
+      && mesh_cache_section_fits(
+             header->submesh_offset,
+             header->submesh_count,
+             sizeof(struct mesh_cache_submesh),
+             size
+         )
+      && mesh_cache_section_fits(
+             header->material_offset,
+             header->material_count,
+             sizeof(struct mesh_cache_material),
+             size
+         )
+      && mesh_cache_section_fits(
+             header->meshlet_offset,
+             header->meshlet_count,
+             sizeof(struct meshlet),
+             size
+         );
+}
+
+// Every range a submesh, its LODs and its meshlets point at has to be inside
+// the vertices, indices and meshlets of the cache. Submeshes are stored back
+// to back, so their base vertices can't go down either.
+static int mesh_cache_submeshes_valid(
+    const struct mesh_cache_header *header,
+    const unsigned char *data
+) {
+  const struct mesh_cache_submesh *submeshes =
+      (const void *) (data + header->submesh_offset);
+  const struct meshlet *meshlets =
+      (const void *) (data + header->meshlet_offset);
+  int64_t base_vertex = 0;
+
+  for (uint32_t i = 0; i < header->submesh_count; i++) {
+    const struct mesh_cache_submesh *submesh = &submeshes[i];
+    if (submesh->base_vertex < base_vertex
+        || (uint64_t) submesh->base_vertex > header->vertex_count
+        || !mesh_cache_range_fits(
+            submesh->first_index,
+            submesh->index_count,
+            header->index_count
+        )
+        || submesh->lod_count < 1 || submesh->lod_count > SCENE_MAX_LODS
+        || !mesh_cache_range_fits(
+            submesh->first_meshlet,
+            submesh->meshlet_count,
+            header->meshlet_count
+        ))
+      return 0;
+    base_vertex = submesh->base_vertex;
+
+    for (uint32_t lod = 0; lod < submesh->lod_count; lod++) {
+      if (!mesh_cache_range_fits(
+              submesh->lods[lod].first_index,
+              submesh->lods[lod].index_count,
+              header->index_count
+          ))
+        return 0;
+    }
+  }
+
+  for (uint64_t i = 0; i < header->meshlet_count; i++) {
+    if (!mesh_cache_range_fits(
+            meshlets[i].first_index,
+            meshlets[i].index_count,
+            header->index_count
+        ))
+      return 0;
+  }
+
+  return 1;
+}
+
+// Maps a cooked mesh, the packed vertices and indices of the scene point into
+// the mapping until free_scene_geometry is called. Returns 0 if the cache is
+// missing, corrupt or was cooked from a different version of the source.
+int load_mesh_cache(
+    const char *cache_path,
+    uint64_t source_hash,
+    uint64_t source_size,
+    struct imported_scene *out
+) {
+  memset(out, 0, sizeof(*out));
+
+  size_t size;
+  unsigned char *data = map_file(cache_path, &size);
+  if (!data)
+    return 0;
+
+  const struct mesh_cache_header *header = (const void *) data;
+  if (size < sizeof(*header)
+      || memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(header->magic)) != 0
+      || header->version != MESH_CACHE_VERSION
+      || header->vertex_stride != sizeof(struct packed_vertex)
+      || (header->index_size != 2 && header->index_size != 4)
+      || header->source_hash != source_hash
+      || header->source_size != source_size
+      || !mesh_cache_header_valid(header, size)
+      || !mesh_cache_submeshes_valid(header, data)) {
+    unmap_file(data, size);
+    return 0;
+  }
+
+  out->mapping = data;
+  out->mapping_size = size;
+
+  out->vertex_count = header->vertex_count;
+  out->index_count = header->index_count;
+  out->packed_vertices = data + header->vertex_offset;
+  out->packed_indices = data + header->index_offset;
+  out->index_type =
+      header->index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+  const struct mesh_cache_submesh *submeshes =
+      (const void *) (data + header->submesh_offset);
+  out->submesh_count = header->submesh_count;
+  out->submeshes =
+      malloc(sizeof(struct scene_submesh) * (header->submesh_count + 1));
+  for (uint32_t i = 0; i < header->submesh_count; i++) {
+    out->submeshes[i].base_vertex = submeshes[i].base_vertex;
+    out->submeshes[i].first_index = submeshes[i].first_index;
+    out->submeshes[i].index_count = submeshes[i].index_count;
+    out->submeshes[i].material = submeshes[i].material;
+    memcpy(
+        out->submeshes[i].bounds_min,
+        submeshes[i].bounds_min,
+        sizeof(submeshes[i].bounds_min)
+    );
+    memcpy(
+        out->submeshes[i].bounds_max,
+        submeshes[i].bounds_max,
+        sizeof(submeshes[i].bounds_max)
+    );
+
+    out->submeshes[i].lod_count = submeshes[i].lod_count;
+    out->submeshes[i].current_lod = 0;
+    for (uint32_t lod = 0; lod < out->submeshes[i].lod_count; lod++) {
+      struct scene_lod *destination = &out->submeshes[i].lods[lod];
+      destination->first_index = submeshes[i].lods[lod].first_index;
+      destination->index_count = submeshes[i].lods[lod].index_count;
+      destination->error = submeshes[i].lods[lod].error;
+    }
+
+    out->submeshes[i].first_meshlet = submeshes[i].first_meshlet;
+    out->submeshes[i].meshlet_count = submeshes[i].meshlet_count;
+    out->submeshes[i].first_draw = 0;
+    out->submeshes[i].draw_count = 0;
+  }
+
+  const struct mesh_cache_material *materials =
+      (const void *) (data + header->material_offset);
+  out->material_count = header->material_count;
+  out->materials =
+      calloc(header->material_count + 1, sizeof(struct scene_material));
+  for (uint32_t i = 0; i < header->material_count; i++) {
+    memcpy(
+        out->materials[i].texture_path,
+        materials[i].texture_path,
+        sizeof(out->materials[i].texture_path)
+    );
+    out->materials[i].texture_path[sizeof(materials[i].texture_path) - 1] = 0;
+  }
+
+  // Meshlet bounds are copied out of the mapping, culling wants them as
+  // separate arrays and they outlive the packed geometry
+  store_scene_meshlets(
+      out,
+      (const void *) (data + header->meshlet_offset),
+      header->meshlet_count
+  );
+
+  return 1;
+}
+
+static void mesh_cache_write_padding(FILE *file, uint64_t offset) {
+  static const char zeros[MESH_CACHE_ALIGNMENT] = {0};
+  uint64_t aligned = mesh_cache_align(offset);
+  fwrite(zeros, 1, aligned - offset, file);
+}
+
+// Writes the scene next to the source. The file is written under a temporary
+// name and renamed, so a crash never leaves a half written cache behind.
+int write_mesh_cache(
+    const char *cache_path,
+    uint64_t source_hash,
+    uint64_t source_size,
+    const struct imported_scene *scene
+) {
+  struct mesh_cache_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+  header.version = MESH_CACHE_VERSION;
+  header.vertex_stride = sizeof(struct packed_vertex);
+  header.index_size = packed_index_size(scene);
+  header.source_hash = source_hash;
+  header.source_size = source_size;
+  header.vertex_count = scene->vertex_count;
+  header.index_count = scene->index_count;
+  header.submesh_count = scene->submesh_count;
+  header.material_count = scene->material_count;
+  header.meshlet_count = scene->meshlets.count;
+
+  uint64_t vertex_bytes = scene->vertex_count * header.vertex_stride;
+  uint64_t index_bytes = scene->index_count * header.index_size;
+  uint64_t submesh_bytes =
+      scene->submesh_count * sizeof(struct mesh_cache_submesh);
+  uint64_t material_bytes =
+      scene->material_count * sizeof(struct mesh_cache_material);
+
+  header.vertex_offset = mesh_cache_align(sizeof(header));
+  header.index_offset = mesh_cache_align(header.vertex_offset + vertex_bytes);
+  header.submesh_offset = mesh_cache_align(header.index_offset + index_bytes);
+  header.material_offset =
+      mesh_cache_align(header.submesh_offset + submesh_bytes);
+  header.meshlet_offset =
+      mesh_cache_align(header.material_offset + material_bytes);
+
+  char temp_path[512];
+  snprintf(temp_path, sizeof(temp_path), "%s.tmp", cache_path);
+
+  FILE *file = fopen(temp_path, "wb");
+  if (!file)
+    return 0;
+
+  fwrite(&header, sizeof(header), 1, file);
+  mesh_cache_write_padding(file, sizeof(header));
+
+  fwrite(scene->packed_vertices, 1, vertex_bytes, file);
+  mesh_cache_write_padding(file, header.vertex_offset + vertex_bytes);
+
+  fwrite(scene->packed_indices, 1, index_bytes, file);
+  mesh_cache_write_padding(file, header.index_offset + index_bytes);
+
+  for (unsigned int i = 0; i < scene->submesh_count; i++) {
+    const struct scene_submesh *source = &scene->submeshes[i];
+    struct mesh_cache_submesh submesh;
+    submesh.base_vertex = source->base_vertex;
+    submesh.first_index = source->first_index;
+    submesh.index_count = (uint32_t) source->index_count;
+    submesh.material = source->material;
+    memcpy(submesh.bounds_min, source->bounds_min, sizeof(submesh.bounds_min));
+    memcpy(submesh.bounds_max, source->bounds_max, sizeof(submesh.bounds_max));
+
+    memset(submesh.lods, 0, sizeof(submesh.lods));
+    submesh.lod_count = source->lod_count;
+    for (unsigned int lod = 0; lod < source->lod_count; lod++) {
+      submesh.lods[lod].first_index = source->lods[lod].first_index;
+      submesh.lods[lod].index_count = (uint32_t) source->lods[lod].index_count;
+      submesh.lods[lod].error = source->lods[lod].error;
+    }
+
+    submesh.first_meshlet = source->first_meshlet;
+    submesh.meshlet_count = source->meshlet_count;
+    fwrite(&submesh, sizeof(submesh), 1, file);
+  }
+  mesh_cache_write_padding(file, header.submesh_offset + submesh_bytes);
+
+  for (unsigned int i = 0; i < scene->material_count; i++) {
+    struct mesh_cache_material material;
+    memset(&material, 0, sizeof(material));
+    memcpy(
+        material.texture_path,
+        scene->materials[i].texture_path,
+        sizeof(material.texture_path)
+    );
+    fwrite(&material, sizeof(material), 1, file);
+  }
+  mesh_cache_write_padding(file, header.material_offset + material_bytes);
+
+  for (size_t i = 0; i < scene->meshlets.count; i++) {
+    struct meshlet meshlet;
+    get_scene_meshlet(&scene->meshlets, i, &meshlet);
+    fwrite(&meshlet, sizeof(meshlet), 1, file);
+  }
+
+  int ok = !ferror(file);
+  ok = fclose(file) == 0 && ok;
+  if (!ok) {
+    remove(temp_path);
+    return 0;
+  }
+
+#ifdef _WIN32
+  remove(cache_path); // rename doesn't replace existing files on Windows
+#endif
+  return rename(temp_path, cache_path) == 0;
+}
+
+// Loads the cooked version of the model if it is still up to date, otherwise
+// imports the model through assimp, optimizes it, builds the LOD chain and
+// the meshlets and cooks it all for the next run
+int load_scene(
+    const char *source_path,
+    const char *cache_path,
+    struct imported_scene *out
+) {
+  uint64_t source_size = 0;
+  uint64_t source_hash = hash_file(source_path, &source_size);
+
+  if (!source_size
+      || !load_mesh_cache(cache_path, source_hash, source_size, out)) {
+    if (!import_scene(source_path, out))
+      return 0;
+
+    // One arena holds the temporaries of every cooking step
+    struct arena scratch;
+    init_arena(&scratch, 0);
+
+    optimize_scene(out, &scratch);
+    generate_scene_lods(out, &scratch);
+    build_scene_meshlets(out, &scratch);
+    pack_scene(out);
+
+    print_arena_stats(&scratch, "Cooking scratch");
+    free_arena(&scratch);
+
+    if (source_size
+        && !write_mesh_cache(cache_path, source_hash, source_size, out))
+      printf("Couldn't write the mesh cache to %s\n", cache_path);
+  }
+
+  // Callers that upload everything at once can draw right away
+  out->resident_vertices = out->vertex_count;
+  out->resident_indices = out->index_count;
+  return 1;
+}
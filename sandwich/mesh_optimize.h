@@ -0,0 +1,539 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/arena.h"
+#include "scene_import.h"
+
+// Import time index/vertex reordering, run once per submesh before the scene
+// gets packed and cooked:
+//   1. Tipsify (Sander, Nehab & Barczak 2007) orders triangles for the post
+//      transform vertex cache
+//   2. the resulting triangle clusters are sorted so outward facing clusters
+//      are drawn first, which cuts overdraw without hurting the cache much
+//   3. vertices are renumbered in the order they are first used so vertex
+//      fetch walks memory linearly
+// Temporaries come from a scratch arena and are rewound before returning.
+
+#define VERTEX_CACHE_SIZE 16
+#define OVERDRAW_THRESHOLD 1.05f // allowed ACMR increase from splitting
+
+struct vertex_cache_stats {
+  size_t triangles, vertices, misses;
+};
+
+// Average cache miss ratio, transformed vertices per triangle (0.5 - 3)
+static float vertex_cache_acmr(struct vertex_cache_stats stats) {
+  return stats.triangles ? (float) stats.misses / stats.triangles : 0.0f;
+}
+
+// Average transform to vertex ratio, 1.0 is optimal
+static float vertex_cache_atvr(struct vertex_cache_stats stats) {
+  return stats.vertices ? (float) stats.misses / stats.vertices : 0.0f;
+}
+
+// Simulates a FIFO cache, the way most GPUs without a fixed LRU cache behave
+struct vertex_cache_stats analyze_vertex_cache(
+    const uint32_t *indices,
+    size_t index_count,
+    size_t vertex_count,
+    struct arena *scratch
+) {
+  struct vertex_cache_stats stats = {index_count / 3, 0, 0};
+  struct arena_mark mark = arena_mark(scratch);
+  uint32_t *timestamps =
+      arena_calloc(scratch, vertex_count + 1, sizeof(uint32_t));
+  uint32_t time = VERTEX_CACHE_SIZE + 1;
+
+  for (size_t i = 0; i < index_count; i++) {
+    uint32_t index = indices[i];
+
+    if (timestamps[index] == 0)
+      stats.vertices++;
+
+    if (time - timestamps[index] > VERTEX_CACHE_SIZE) {
+      timestamps[index] = time++;
+      stats.misses++;
+    }
+  }
+
+  arena_rewind(scratch, mark);
+  return stats;
+}
+
+// Vertex -> triangle adjacency in compressed rows, lives in the scratch arena
+struct triangle_adjacency {
+  uint32_t *counts;
+  uint32_t *offsets;
+  uint32_t *triangles;
+};
+
+static void build_triangle_adjacency(
+    struct triangle_adjacency *adjacency,
+    const uint32_t *indices,
+    size_t index_count,
+    size_t vertex_count,
+    struct arena *scratch
+) {
+  adjacency->counts =
+      arena_calloc(scratch, vertex_count + 1, sizeof(uint32_t));
+  adjacency->offsets =
+      arena_alloc(scratch, sizeof(uint32_t) * (vertex_count + 1));
+  adjacency->triangles =
+      arena_alloc(scratch, sizeof(uint32_t) * (index_count + 1));
+
+  for (size_t i = 0; i < index_count; i++)
+    adjacency->counts[indices[i]]++;
+
+  uint32_t offset = 0;
+  for (size_t v = 0; v < vertex_count; v++) {
+    adjacency->offsets[v] = offset;
+    offset += adjacency->counts[v];
+  }
+
+  for (size_t i = 0; i < index_count; i++) {
+    uint32_t v = indices[i];
+    adjacency->triangles[adjacency->offsets[v]++] = (uint32_t) (i / 3);
+  }
+
+  // offsets were advanced while filling, rewind them
+  for (size_t v = 0; v < vertex_count; v++)
+    adjacency->offsets[v] -= adjacency->counts[v];
+}
+
+// Picks the next fanning vertex, -1 once every triangle is emitted
+static int64_t tipsify_next_vertex(
+    const uint32_t *candidates,
+    size_t candidate_count,
+    const uint32_t *live_triangles,
+    const uint32_t *cache_time,
+    uint32_t time,
+    uint32_t *dead_end,
+    size_t *dead_end_top,
+    uint32_t *cursor,
+    size_t vertex_count
+) {
+  // Prefer vertices that will still be in the cache when all their remaining
+  // triangles are emitted, the oldest of them first
+  int64_t best = -1;
+  int64_t best_priority = -1;
+  for (size_t i = 0; i < candidate_count; i++) {
+    uint32_t v = candidates[i];
+    if (!live_triangles[v])
+      continue;
+
+    int64_t priority = 0;
+    if (time - cache_time[v] + 2 * live_triangles[v] <= VERTEX_CACHE_SIZE)
+      priority = time - cache_time[v];
+
+    if (priority > best_priority) {
+      best_priority = priority;
+      best = v;
+    }
+  }
+  if (best >= 0)
+    return best;
+
+  // Dead end, go back to recently used vertices
+  while (*dead_end_top > 0) {
+    uint32_t v = dead_end[--*dead_end_top];
+    if (live_triangles[v])
+      return v;
+  }
+
+  // Still nothing, continue with the next unfinished vertex in input order
+  while (*cursor < vertex_count) {
+    if (live_triangles[*cursor])
+      return *cursor;
+    (*cursor)++;
+  }
+
+  return -1;
+}
+
+// Reorders triangles for the vertex cache. Writes the new order to
+// destination and marks the triangles that start a new cluster, a cluster
+// ends wherever Tipsify had to jump to a vertex that wasn't just emitted.
+static void tipsify(
+    uint32_t *destination,
+    uint8_t *cluster_start,
+    const uint32_t *indices,
+    size_t index_count,
+    size_t vertex_count,
+    struct arena *scratch
+) {
+  size_t triangle_count = index_count / 3;
+  struct arena_mark mark = arena_mark(scratch);
+
+  struct triangle_adjacency adjacency;
+  build_triangle_adjacency(
+      &adjacency,
+      indices,
+      index_count,
+      vertex_count,
+      scratch
+  );
+
+  uint32_t *live_triangles =
+      arena_alloc(scratch, sizeof(uint32_t) * (vertex_count + 1));
+  memcpy(live_triangles, adjacency.counts, sizeof(uint32_t) * vertex_count);
+
+  uint32_t *cache_time =
+      arena_calloc(scratch, vertex_count + 1, sizeof(uint32_t));
+  uint32_t *dead_end =
+      arena_alloc(scratch, sizeof(uint32_t) * (index_count + 1));
+  uint32_t *candidates =
+      arena_alloc(scratch, sizeof(uint32_t) * (index_count + 1));
+  uint8_t *emitted = arena_calloc(scratch, triangle_count + 1, 1);
+
+  size_t dead_end_top = 0, output = 0;
+  uint32_t time = VERTEX_CACHE_SIZE + 1, cursor = 0;
+  int64_t fanning = triangle_count ? (int64_t) indices[0] : -1;
+  int jumped = 1;
+
+  while (fanning >= 0) {
+    size_t candidate_count = 0;
+    const uint32_t *triangles =
+        adjacency.triangles + adjacency.offsets[fanning];
+
+    for (uint32_t i = 0; i < adjacency.counts[fanning]; i++) {
+      uint32_t triangle = triangles[i];
+      if (emitted[triangle])
+        continue;
+
+      cluster_start[output / 3] = jumped;
+      jumped = 0;
+
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = indices[triangle * 3 + k];
+        destination[output++] = v;
+
+        dead_end[dead_end_top++] = v;
+        candidates[candidate_count++] = v;
+        live_triangles[v]--;
+
+        if (time - cache_time[v] > VERTEX_CACHE_SIZE)
+          cache_time[v] = time++;
+      }
+
+      emitted[triangle] = 1;
+    }
+
+    int64_t next = tipsify_next_vertex(
+        candidates,
+        candidate_count,
+        live_triangles,
+        cache_time,
+        time,
+        dead_end,
+        &dead_end_top,
+        &cursor,
+        vertex_count
+    );
+
+    // Anything that isn't one of the vertices just emitted is a jump
+    jumped = 1;
+    for (size_t i = 0; i < candidate_count && next >= 0; i++) {
+      if (candidates[i] == next) {
+        jumped = 0;
+        break;
+      }
+    }
+    fanning = next;
+  }
+
+  arena_rewind(scratch, mark);
+}
+
+struct triangle_cluster {
+  uint32_t first_triangle, triangle_count;
+  float sort_key;
+};
+
+static int compare_clusters(const void *a, const void *b) {
+  const struct triangle_cluster *x = a, *y = b;
+  if (x->sort_key != y->sort_key)
+    return x->sort_key > y->sort_key ? -1 : 1;
+  return x->first_triangle < y->first_triangle ? -1 : 1;
+}
+
+// Splits the big Tipsify clusters further wherever the cache state is about
+// as good as a fresh start, so the overdraw sort has more freedom
+static void split_clusters(
+    uint8_t *cluster_start,
+    const uint32_t *indices,
+    size_t index_count,
+    size_t vertex_count,
+    struct arena *scratch
+) {
+  struct vertex_cache_stats total =
+      analyze_vertex_cache(indices, index_count, vertex_count, scratch);
+  float threshold = vertex_cache_acmr(total) * OVERDRAW_THRESHOLD;
+
+  struct arena_mark mark = arena_mark(scratch);
+  uint32_t *timestamps =
+      arena_calloc(scratch, vertex_count + 1, sizeof(uint32_t));
+  uint32_t time = VERTEX_CACHE_SIZE + 1;
+  size_t cluster_triangles = 0, cluster_misses = 0;
+
+  for (size_t t = 0; t < index_count / 3; t++) {
+    if (cluster_start[t]
+        || (cluster_triangles
+            && (float) cluster_misses / cluster_triangles <= threshold
+            && cluster_triangles >= VERTEX_CACHE_SIZE)) {
+      cluster_start[t] = 1;
+      cluster_triangles = cluster_misses = 0;
+      time += VERTEX_CACHE_SIZE + 1; // the new cluster starts cold
+    }
+
+    for (int k = 0; k < 3; k++) {
+      uint32_t index = indices[t * 3 + k];
+      if (time - timestamps[index] > VERTEX_CACHE_SIZE) {
+        timestamps[index] = time++;
+        cluster_misses++;
+      }
+    }
+    cluster_triangles++;
+  }
+
+  arena_rewind(scratch, mark);
+}
+
+// Sorts the clusters by how much they face away from the mesh center, so
+// silhouette & front clusters are drawn first and occlude the rest
+static void sort_clusters_for_overdraw(
+    uint32_t *indices,
+    const uint8_t *cluster_start,
+    size_t index_count,
+    const struct mesh_vertex *vertices,
+    size_t vertex_count,
+    struct arena *scratch
+) {
+  size_t triangle_count = index_count / 3;
+  if (!triangle_count)
+    return;
+  struct arena_mark mark = arena_mark(scratch);
+
+  float mesh_center[3] = {0, 0, 0};
+  for (size_t v = 0; v < vertex_count; v++) {
+    for (int axis = 0; axis < 3; axis++)
+      mesh_center[axis] += vertices[v].position[axis] / vertex_count;
+  }
+
+  size_t cluster_count = 0;
+  for (size_t t = 0; t < triangle_count; t++)
+    cluster_count += cluster_start[t] || t == 0;
+
+  struct triangle_cluster *clusters =
+      arena_alloc(scratch, sizeof(struct triangle_cluster) * cluster_count);
+
+  size_t cluster = (size_t) -1;
+  for (size_t t = 0; t < triangle_count; t++) {
+    if (cluster_start[t] || t == 0) {
+      cluster++;
+      clusters[cluster].first_triangle = (uint32_t) t;
+      clusters[cluster].triangle_count = 0;
+    }
+    clusters[cluster].triangle_count++;
+  }
+
+  for (size_t c = 0; c < cluster_count; c++) {
+    float center[3] = {0, 0, 0}, normal[3] = {0, 0, 0}, area = 0.0f;
+
+    for (uint32_t t = 0; t < clusters[c].triangle_count; t++) {
+      const uint32_t *triangle =
+          indices + (clusters[c].first_triangle + t) * 3;
+      const float *a = vertices[triangle[0]].position;
+      const float *b = vertices[triangle[1]].position;
+      const float *d = vertices[triangle[2]].position;
+
+      float ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+      float ad[3] = {d[0] - a[0], d[1] - a[1], d[2] - a[2]};
+      float n[3] = {
+          ab[1] * ad[2] - ab[2] * ad[1],
+          ab[2] * ad[0] - ab[0] * ad[2],
+          ab[0] * ad[1] - ab[1] * ad[0],
+      };
+      float triangle_area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+      for (int axis = 0; axis < 3; axis++) {
+        center[axis] +=
+            (a[axis] + b[axis] + d[axis]) / 3.0f * triangle_area;
+        normal[axis] += n[axis];
+      }
+      area += triangle_area;
+    }
+
+    float normal_length = sqrtf(
+        normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]
+    );
+
+    clusters[c].sort_key = 0.0f;
+    if (area > 0.0f && normal_length > 0.0f) {
+      for (int axis = 0; axis < 3; axis++) {
+        clusters[c].sort_key += (center[axis] / area - mesh_center[axis])
+                              * normal[axis] / normal_length;
+      }
+    }
+  }
+
+  qsort(clusters, cluster_count, sizeof(*clusters), compare_clusters);
+
+  uint32_t *sorted = arena_alloc(scratch, sizeof(uint32_t) * index_count);
+  size_t output = 0;
+  for (size_t c = 0; c < cluster_count; c++) {
+    size_t count = clusters[c].triangle_count * 3;
+    memcpy(
+        sorted + output,
+        indices + clusters[c].first_triangle * 3,
+        sizeof(uint32_t) * count
+    );
+    output += count;
+  }
+
+  memcpy(indices, sorted, sizeof(uint32_t) * index_count);
+  arena_rewind(scratch, mark);
+}
+
+// Renumbers vertices in first use order, unused vertices go last
+static void optimize_vertex_fetch(
+    uint32_t *indices,
+    size_t index_count,
+    struct mesh_vertex *vertices,
+    size_t vertex_count,
+    struct arena *scratch
+) {
+  struct arena_mark mark = arena_mark(scratch);
+  uint32_t *remap =
+      arena_alloc(scratch, sizeof(uint32_t) * (vertex_count + 1));
+  memset(remap, 0xff, sizeof(uint32_t) * vertex_count);
+
+  uint32_t next = 0;
+  for (size_t i = 0; i < index_count; i++) {
+    if (remap[indices[i]] == UINT32_MAX)
+      remap[indices[i]] = next++;
+    indices[i] = remap[indices[i]];
+  }
+  for (size_t v = 0; v < vertex_count; v++) {
+    if (remap[v] == UINT32_MAX)
+      remap[v] = next++;
+  }
+
+  struct mesh_vertex *reordered =
+      arena_alloc(scratch, sizeof(struct mesh_vertex) * (vertex_count + 1));
+  for (size_t v = 0; v < vertex_count; v++)
+    reordered[remap[v]] = vertices[v];
+
+  memcpy(vertices, reordered, sizeof(struct mesh_vertex) * vertex_count);
+  arena_rewind(scratch, mark);
+}
+
+// Only the Tipsify pass, for index ranges that share their vertices with
+// another range and can't be reordered on their own (LODs)
+void optimize_vertex_cache(
+    uint32_t *indices,
+    size_t index_count,
+    size_t vertex_count,
+    struct arena *scratch
+) {
+  size_t triangle_count = index_count / 3;
+  if (!triangle_count)
+    return;
+
+  struct arena_mark mark = arena_mark(scratch);
+  uint32_t *ordered = arena_alloc(scratch, sizeof(uint32_t) * index_count);
+  uint8_t *cluster_start = arena_calloc(scratch, triangle_count, 1);
+
+  tipsify(ordered, cluster_start, indices, index_count, vertex_count, scratch);
+  memcpy(indices, ordered, sizeof(uint32_t) * index_count);
+
+  arena_rewind(scratch, mark);
+}
+
+void optimize_mesh(
+    uint32_t *indices,
+    size_t index_count,
+    struct mesh_vertex *vertices,
+    size_t vertex_count,
+    struct arena *scratch
+) {
+  size_t triangle_count = index_count / 3;
+  if (!triangle_count)
+    return;
+
+  struct arena_mark mark = arena_mark(scratch);
+  uint32_t *ordered = arena_alloc(scratch, sizeof(uint32_t) * index_count);
+  uint8_t *cluster_start = arena_calloc(scratch, triangle_count, 1);
+
+  tipsify(ordered, cluster_start, indices, index_count, vertex_count, scratch);
+  split_clusters(cluster_start, ordered, index_count, vertex_count, scratch);
+  sort_clusters_for_overdraw(
+      ordered,
+      cluster_start,
+      index_count,
+      vertices,
+      vertex_count,
+      scratch
+  );
+
+  memcpy(indices, ordered, sizeof(uint32_t) * index_count);
+  arena_rewind(scratch, mark);
+
+  optimize_vertex_fetch(indices, index_count, vertices, vertex_count, scratch);
+}
+
+static struct vertex_cache_stats analyze_scene(
+    const struct imported_scene *scene,
+    struct arena *scratch
+) {
+  struct vertex_cache_stats total = {0, 0, 0};
+
+  for (unsigned int i = 0; i < scene->submesh_count; i++) {
+    const struct scene_submesh *submesh = &scene->submeshes[i];
+    size_t vertex_count = scene_submesh_vertex_count(scene, i);
+
+    struct vertex_cache_stats stats = analyze_vertex_cache(
+        scene->indices + submesh->first_index,
+        submesh->index_count,
+        vertex_count,
+        scratch
+    );
+    total.triangles += stats.triangles;
+    total.vertices += stats.vertices;
+    total.misses += stats.misses;
+  }
+
+  return total;
+}
+
+// Optimizes every submesh of a freshly imported scene
+void optimize_scene(struct imported_scene *scene, struct arena *scratch) {
+  struct vertex_cache_stats before = analyze_scene(scene, scratch);
+
+  for (unsigned int i = 0; i < scene->submesh_count; i++) {
+    const struct scene_submesh *submesh = &scene->submeshes[i];
+    size_t vertex_count = scene_submesh_vertex_count(scene, i);
+
+    optimize_mesh(
+        scene->indices + submesh->first_index,
+        submesh->index_count,
+        scene->vertices + submesh->base_vertex,
+        vertex_count,
+        scratch
+    );
+  }
+
+  struct vertex_cache_stats after = analyze_scene(scene, scratch);
+
+  printf(
+      "Vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+      vertex_cache_acmr(before),
+      vertex_cache_acmr(after),
+      vertex_cache_atvr(before),
+      vertex_cache_atvr(after)
+  );
+}
@@ -0,0 +1,466 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/mat4.h"
+#include "mesh_optimize.h"
+#include "scene_import.h"
+
+// Quadric error metric simplifier (Garland & Heckbert 1997) used to build the
+// LOD chain at import time. Edges only ever collapse onto one of their two
+// vertices, so every LOD is just another index range into the vertex buffer
+// that LOD 0 already uses. Vertices on open borders (including UV seams,
+// which look like borders since their vertices are split) never move.
+
+#define LOD_REDUCTION 0.5f // every LOD targets half the triangles of the last
+#define LOD_MIN_TRIANGLES 32
+#define LOD_PIXEL_ERROR 1.0f // allowed screen space error when selecting
+
+// Symmetric 4x4 matrix, a b c d e f g h i j stored as
+//   a b c d
+//     e f g
+//       h i
+//         j
+struct quadric {
+  double m[10];
+};
+
+static void quadric_add_plane(
+    struct quadric *q,
+    double a,
+    double b,
+    double c,
+    double d
+) {
+  q->m[0] += a * a;
+  q->m[1] += a * b;
+  q->m[2] += a * c;
+  q->m[3] += a * d;
+  q->m[4] += b * b;
+  q->m[5] += b * c;
+  q->m[6] += b * d;
+  q->m[7] += c * c;
+  q->m[8] += c * d;
+  q->m[9] += d * d;
+}
+
+static void quadric_add(struct quadric *q, const struct quadric *other) {
+  for (int i = 0; i < 10; i++)
+    q->m[i] += other->m[i];
+}
+
+// Sum of squared distances of a point to all planes of the quadric
+static double quadric_error(const struct quadric *q, const float *p) {
+  double x = p[0], y = p[1], z = p[2];
+  const double *m = q->m;
+
+  double error = m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z
+               + 2 * m[3] * x + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+               + m[7] * z * z + 2 * m[8] * z + m[9];
+  return error > 0.0 ? error : 0.0;
+}
+
+static void triangle_normal(
+    const float *a,
+    const float *b,
+    const float *c,
+    float *normal
+) {
+  float ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+  float ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+
+  normal[0] = ab[1] * ac[2] - ab[2] * ac[1];
+  normal[1] = ab[2] * ac[0] - ab[0] * ac[2];
+  normal[2] = ab[0] * ac[1] - ab[1] * ac[0];
+}
+
+struct edge_collapse {
+  uint32_t from, to;
+  double cost;
+};
+
+static int compare_collapses(const void *a, const void *b) {
+  const struct edge_collapse *x = a, *y = b;
+  if (x->cost != y->cost)
+    return x->cost < y->cost ? -1 : 1;
+  return 0;
+}
+
+static uint32_t follow_remap(uint32_t *remap, uint32_t v) {
+  while (remap[v] != v) {
+    remap[v] = remap[remap[v]];
+    v = remap[v];
+  }
+  return v;
+}
+
+// Would moving `from` onto `to` flip or degenerate a triangle around `from`?
+static int collapse_flips(
+    const uint32_t *indices,
+    const uint32_t *triangles,
+    uint32_t triangle_count,
+    uint32_t *remap,
+    const struct mesh_vertex *vertices,
+    uint32_t from,
+    uint32_t to
+) {
+  for (uint32_t i = 0; i < triangle_count; i++) {
+    const uint32_t *triangle = indices + triangles[i] * 3;
+    uint32_t v[3];
+    for (int k = 0; k < 3; k++)
+      v[k] = follow_remap(remap, triangle[k]);
+
+    if (v[0] == v[1] || v[1] == v[2] || v[0] == v[2])
+      continue; // already collapsed
+    if (v[0] == to || v[1] == to || v[2] == to)
+      continue; // this one disappears with the edge
+
+    float before[3], after[3];
+    triangle_normal(
+        vertices[v[0]].position,
+        vertices[v[1]].position,
+        vertices[v[2]].position,
+        before
+    );
+    for (int k = 0; k < 3; k++) {
+      if (v[k] == from)
+        v[k] = to;
+    }
+    triangle_normal(
+        vertices[v[0]].position,
+        vertices[v[1]].position,
+        vertices[v[2]].position,
+        after
+    );
+
+    float dot = before[0] * after[0] + before[1] * after[1]
+              + before[2] * after[2];
+    if (dot <= 0.0f)
+      return 1;
+  }
+
+  return 0;
+}
+
+// Marks vertices that sit on an edge used by only one triangle. Edges are
+// compared by index, so the mesh has to share its vertices between triangles
+// (import_scene joins them), otherwise every vertex is on a border.
+static void find_border_vertices(
+    uint8_t *border,
+    const uint32_t *indices,
+    size_t index_count,
+    const struct triangle_adjacency *adjacency
+) {
+  for (size_t t = 0; t < index_count / 3; t++) {
+    for (int k = 0; k < 3; k++) {
+      uint32_t a = indices[t * 3 + k], b = indices[t * 3 + (k + 1) % 3];
+
+      // Count the triangles around a that also use b
+      uint32_t shared = 0;
+      const uint32_t *triangles =
+          adjacency->triangles + adjacency->offsets[a];
+      for (uint32_t i = 0; i < adjacency->counts[a]; i++) {
+        const uint32_t *other = indices + triangles[i] * 3;
+        shared += other[0] == b || other[1] == b || other[2] == b;
+      }
+
+      if (shared == 1)
+        border[a] = border[b] = 1;
+    }
+  }
+}
+
+// Simplifies a triangle list towards target_index_count, writing the result
+// to destination (which may alias indices). Returns the new index count and
+// the largest error, in mesh units, introduced by any collapse.
+size_t simplify_mesh(
+    uint32_t *destination,
+    const uint32_t *indices,
+    size_t index_count,
+    const struct mesh_vertex *vertices,
+    size_t vertex_count,
+    size_t target_index_count,
+    float *result_error,
+    struct arena *scratch
+) {
+  struct arena_mark mark = arena_mark(scratch);
+  uint32_t *current =
+      arena_alloc(scratch, sizeof(uint32_t) * (index_count + 1));
+  memcpy(current, indices, sizeof(uint32_t) * index_count);
+
+  struct quadric *quadrics =
+      arena_calloc(scratch, vertex_count + 1, sizeof(struct quadric));
+  uint8_t *locked = arena_calloc(scratch, vertex_count + 1, 1);
+  uint8_t *touched = arena_alloc(scratch, vertex_count + 1);
+  uint32_t *remap =
+      arena_alloc(scratch, sizeof(uint32_t) * (vertex_count + 1));
+  struct edge_collapse *collapses =
+      arena_alloc(scratch, sizeof(struct edge_collapse) * (index_count + 1));
+  double max_cost = 0.0;
+
+  for (size_t t = 0; t < index_count / 3; t++) {
+    const float *a = vertices[current[t * 3 + 0]].position;
+    const float *b = vertices[current[t * 3 + 1]].position;
+    const float *c = vertices[current[t * 3 + 2]].position;
+
+    float n[3];
+    triangle_normal(a, b, c, n);
+    float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0.0f)
+      continue;
+
+    double nx = n[0] / length, ny = n[1] / length, nz = n[2] / length;
+    double d = -(nx * a[0] + ny * a[1] + nz * a[2]);
+    for (int k = 0; k < 3; k++)
+      quadric_add_plane(&quadrics[current[t * 3 + k]], nx, ny, nz, d);
+  }
+
+  // The adjacency is rebuilt every pass, rewinding drops the old one
+  struct arena_mark pass_mark = arena_mark(scratch);
+  struct triangle_adjacency adjacency;
+  build_triangle_adjacency(
+      &adjacency,
+      current,
+      index_count,
+      vertex_count,
+      scratch
+  );
+  find_border_vertices(locked, current, index_count, &adjacency);
+  arena_rewind(scratch, pass_mark);
+
+  while (index_count > target_index_count) {
+    for (size_t v = 0; v < vertex_count; v++)
+      remap[v] = (uint32_t) v;
+    memset(touched, 0, vertex_count);
+
+    build_triangle_adjacency(
+        &adjacency,
+        current,
+        index_count,
+        vertex_count,
+        scratch
+    );
+
+    // Every edge shows up once per triangle that uses it, which is fine
+    size_t collapse_count = 0;
+    for (size_t i = 0; i < index_count; i++) {
+      uint32_t a = current[i];
+      uint32_t b = current[i - i % 3 + (i + 1) % 3];
+      if (locked[a] && locked[b])
+        continue;
+
+      struct quadric q = quadrics[a];
+      quadric_add(&q, &quadrics[b]);
+
+      double a_to_b =
+          locked[a] ? INFINITY : quadric_error(&q, vertices[b].position);
+      double b_to_a =
+          locked[b] ? INFINITY : quadric_error(&q, vertices[a].position);
+
+      struct edge_collapse *collapse = &collapses[collapse_count++];
+      collapse->from = a_to_b <= b_to_a ? a : b;
+      collapse->to = a_to_b <= b_to_a ? b : a;
+      collapse->cost = a_to_b <= b_to_a ? a_to_b : b_to_a;
+    }
+
+    qsort(collapses, collapse_count, sizeof(*collapses), compare_collapses);
+
+    // Roughly two triangles disappear with every collapse, don't overshoot
+    size_t allowed = (index_count - target_index_count) / 6 + 1;
+    size_t collapsed = 0;
+
+    for (size_t i = 0; i < collapse_count && collapsed < allowed; i++) {
+      const struct edge_collapse *collapse = &collapses[i];
+      if (touched[collapse->from] || touched[collapse->to])
+        continue;
+
+      if (collapse_flips(
+              current,
+              adjacency.triangles + adjacency.offsets[collapse->from],
+              adjacency.counts[collapse->from],
+              remap,
+              vertices,
+              collapse->from,
+              collapse->to
+          ))
+        continue;
+
+      remap[collapse->from] = collapse->to;
+      quadric_add(&quadrics[collapse->to], &quadrics[collapse->from]);
+      touched[collapse->from] = touched[collapse->to] = 1;
+
+      if (collapse->cost > max_cost)
+        max_cost = collapse->cost;
+      collapsed++;
+    }
+
+    arena_rewind(scratch, pass_mark);
+
+    if (!collapsed)
+      break;
+
+    // Apply the collapses and drop the triangles that degenerated
+    size_t write = 0;
+    for (size_t t = 0; t < index_count / 3; t++) {
+      uint32_t a = follow_remap(remap, current[t * 3 + 0]);
+      uint32_t b = follow_remap(remap, current[t * 3 + 1]);
+      uint32_t c = follow_remap(remap, current[t * 3 + 2]);
+      if (a == b || b == c || a == c)
+        continue;
+
+      current[write++] = a;
+      current[write++] = b;
+      current[write++] = c;
+    }
+    index_count = write;
+  }
+
+  memcpy(destination, current, sizeof(uint32_t) * index_count);
+  *result_error = (float) sqrt(max_cost);
+
+  arena_rewind(scratch, mark);
+  return index_count;
+}
+
+// Appends simplified versions of every submesh to the index buffer. The
+// error of a LOD is the largest error of it and every LOD before it.
+void generate_scene_lods(struct imported_scene *scene, struct arena *scratch) {
+  // A LOD never has more indices than the one before it
+  size_t capacity = scene->index_count * SCENE_MAX_LODS + 1;
+  scene->indices = realloc(scene->indices, sizeof(uint32_t) * capacity);
+
+  size_t lod_indices = 0;
+  unsigned int simplified = 0;
+
+  for (unsigned int i = 0; i < scene->submesh_count; i++) {
+    struct scene_submesh *submesh = &scene->submeshes[i];
+    size_t vertex_count = scene_submesh_vertex_count(scene, i);
+    const struct mesh_vertex *vertices =
+        scene->vertices + submesh->base_vertex;
+
+    submesh->lod_count = 1;
+    submesh->lods[0].first_index = submesh->first_index;
+    submesh->lods[0].index_count = submesh->index_count;
+    submesh->lods[0].error = 0.0f;
+
+    while (submesh->lod_count < SCENE_MAX_LODS) {
+      const struct scene_lod *previous =
+          &submesh->lods[submesh->lod_count - 1];
+      size_t target =
+          (size_t) (previous->index_count / 3 * LOD_REDUCTION) * 3;
+      if (target < LOD_MIN_TRIANGLES * 3)
+        break;
+
+      uint32_t *destination = scene->indices + scene->index_count;
+      float error;
+      size_t count = simplify_mesh(
+          destination,
+          scene->indices + previous->first_index,
+          previous->index_count,
+          vertices,
+          vertex_count,
+          target,
+          &error,
+          scratch
+      );
+
+      // Not worth another level if the simplifier got stuck on borders
+      if (count == 0 || count > (size_t) previous->index_count * 9 / 10)
+        break;
+
+      optimize_vertex_cache(destination, count, vertex_count, scratch);
+
+      struct scene_lod *lod = &submesh->lods[submesh->lod_count++];
+      lod->first_index = (GLuint) scene->index_count;
+      lod->index_count = (GLsizei) count;
+      lod->error = error > previous->error ? error : previous->error;
+
+      scene->index_count += count;
+      lod_indices += count;
+    }
+
+    simplified += submesh->lod_count > 1;
+  }
+
+  scene->indices =
+      realloc(scene->indices, sizeof(uint32_t) * (scene->index_count + 1));
+
+  printf(
+      "Generated LODs for %u of %u meshes, %zu extra indices\n",
+      simplified,
+      scene->submesh_count,
+      lod_indices
+  );
+}
+
+// Projects a point with a column major matrix, including the divide by w
+static void lod_transform_point(
+    const float *matrix,
+    const float *point,
+    float *result
+) {
+  float r[4];
+  mat4_transform_points(r, matrix, point, 1);
+
+  float w = r[3] != 0.0f ? r[3] : 1.0f;
+  result[0] = r[0] / w;
+  result[1] = r[1] / w;
+  result[2] = r[2] / w;
+}
+
+// Picks the coarsest LOD of every submesh whose error, projected onto the
+// screen, stays under LOD_PIXEL_ERROR pixels
+void select_scene_lods(
+    struct imported_scene *scene,
+    const float *model,
+    const float *view,
+    const float *projection,
+    int viewport_height
+) {
+  float model_view[16];
+  mat4_multiply(model_view, view, model);
+
+  // projection[5] is cot(fov / 2), how far view space units stretch on y
+  float pixels_per_unit = projection[5] * viewport_height * 0.5f;
+
+  for (unsigned int i = 0; i < scene->submesh_count; i++) {
+    struct scene_submesh *submesh = &scene->submeshes[i];
+    submesh->current_lod = 0;
+
+    float center[3], view_center[3];
+    for (int axis = 0; axis < 3; axis++)
+      center[axis] = (submesh->bounds_min[axis] + submesh->bounds_max[axis])
+                   * 0.5f;
+    lod_transform_point(model_view, center, view_center);
+
+    float distance = -view_center[2];
+    if (distance <= 0.0f)
+      continue; // camera is inside or behind, keep full detail
+
+    // How long one object space unit ends up in view space, on any axis
+    float unit_scale = 0.0f;
+    for (int axis = 0; axis < 3; axis++) {
+      float offset[3] = {center[0], center[1], center[2]}, moved[3];
+      offset[axis] += 1.0f;
+      lod_transform_point(model_view, offset, moved);
+
+      float dx = moved[0] - view_center[0], dy = moved[1] - view_center[1],
+            dz = moved[2] - view_center[2];
+      float length = sqrtf(dx * dx + dy * dy + dz * dz);
+      if (length > unit_scale)
+        unit_scale = length;
+    }
+
+    for (unsigned int lod = 1; lod < submesh->lod_count; lod++) {
+      float pixels =
+          submesh->lods[lod].error * unit_scale / distance * pixels_per_unit;
+      if (pixels > LOD_PIXEL_ERROR)
+        break;
+      submesh->current_lod = lod;
+    }
+  }
+}
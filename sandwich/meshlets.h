@@ -0,0 +1,506 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/arena.h"
+#include "../common/frustum.h"
+#include "../common/job_pool.h"
+#include "../common/mat4.h"
+#include "scene_import.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define MESHLET_SSE
+#elif defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define MESHLET_NEON
+#endif
+
+// LOD 0 of every submesh is cut into meshlets of at most 64 vertices and 124
+// triangles. The triangles are already in vertex cache order, so consecutive
+// triangles share vertices and a meshlet is simply a run of the index buffer.
+// Each meshlet gets a bounding sphere and a cone bounding its normals; every
+// frame the meshlets outside the frustum or facing away from the camera are
+// dropped and the rest is drawn with glMultiDrawElementsBaseVertex.
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_CULL_BATCH 1024 // meshlets per job, a multiple of 4
+
+// One meshlet as it is built and stored in the mesh cache
+struct meshlet {
+  uint32_t first_index, index_count;
+  float center[3], radius;
+  // Every triangle normal is within acos(sqrt(1 - cutoff^2)) of the axis, a
+  // cutoff of 1 means the meshlet can't be cone culled
+  float cone_axis[3], cone_cutoff;
+};
+
+static size_t meshlet_storage_size(size_t capacity) {
+  return capacity * (sizeof(GLuint) + sizeof(GLsizei) + sizeof(float) * 8);
+}
+
+// Allocates the arrays of scene->meshlets and fills them from `list`
+void store_scene_meshlets(
+    struct imported_scene *scene,
+    const struct meshlet *list,
+    size_t count
+) {
+  struct scene_meshlets *meshlets = &scene->meshlets;
+  free(meshlets->storage);
+
+  size_t capacity = (count + 3) & ~(size_t) 3;
+  meshlets->count = count;
+  meshlets->capacity = capacity;
+  meshlets->storage = calloc(1, meshlet_storage_size(capacity) + 1);
+
+  char *cursor = meshlets->storage;
+  float **floats[] = {
+      &meshlets->center_x,
+      &meshlets->center_y,
+      &meshlets->center_z,
+      &meshlets->radius,
+      &meshlets->cone_x,
+      &meshlets->cone_y,
+      &meshlets->cone_z,
+      &meshlets->cone_cutoff,
+  };
+  for (int i = 0; i < 8; i++) {
+    *floats[i] = (float *) cursor;
+    cursor += sizeof(float) * capacity;
+  }
+
+  meshlets->first_index = (GLuint *) cursor;
+  cursor += sizeof(GLuint) * capacity;
+  meshlets->index_count = (GLsizei *) cursor;
+
+  for (size_t i = 0; i < count; i++) {
+    meshlets->first_index[i] = list[i].first_index;
+    meshlets->index_count[i] = (GLsizei) list[i].index_count;
+    meshlets->center_x[i] = list[i].center[0];
+    meshlets->center_y[i] = list[i].center[1];
+    meshlets->center_z[i] = list[i].center[2];
+    meshlets->radius[i] = list[i].radius;
+    meshlets->cone_x[i] = list[i].cone_axis[0];
+    meshlets->cone_y[i] = list[i].cone_axis[1];
+    meshlets->cone_z[i] = list[i].cone_axis[2];
+    meshlets->cone_cutoff[i] = list[i].cone_cutoff;
+  }
+
+  // Padding never gets cone culled and has nothing to draw anyway
+  for (size_t i = count; i < capacity; i++)
+    meshlets->cone_cutoff[i] = 1.0f;
+}
+
+// The opposite of store_scene_meshlets, for writing the cache
+void get_scene_meshlet(
+    const struct scene_meshlets *meshlets,
+    size_t i,
+    struct meshlet *out
+) {
+  out->first_index = meshlets->first_index[i];
+  out->index_count = (uint32_t) meshlets->index_count[i];
+  out->center[0] = meshlets->center_x[i];
+  out->center[1] = meshlets->center_y[i];
+  out->center[2] = meshlets->center_z[i];
+  out->radius = meshlets->radius[i];
+  out->cone_axis[0] = meshlets->cone_x[i];
+  out->cone_axis[1] = meshlets->cone_y[i];
+  out->cone_axis[2] = meshlets->cone_z[i];
+  out->cone_cutoff = meshlets->cone_cutoff[i];
+}
+
+static void compute_meshlet_bounds(
+    const struct mesh_vertex *vertices,
+    const uint32_t *indices,
+    size_t index_count,
+    float padding,
+    struct meshlet *out
+) {
+  float min[3] = {INFINITY, INFINITY, INFINITY};
+  float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+  for (size_t i = 0; i < index_count; i++) {
+    const float *p = vertices[indices[i]].position;
+    for (int axis = 0; axis < 3; axis++) {
+      if (p[axis] < min[axis])
+        min[axis] = p[axis];
+      if (p[axis] > max[axis])
+        max[axis] = p[axis];
+    }
+  }
+
+  float radius = 0.0f;
+  for (int axis = 0; axis < 3; axis++)
+    out->center[axis] = (min[axis] + max[axis]) * 0.5f;
+  for (size_t i = 0; i < index_count; i++) {
+    const float *p = vertices[indices[i]].position;
+    float dx = p[0] - out->center[0], dy = p[1] - out->center[1],
+          dz = p[2] - out->center[2];
+    float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+    if (distance > radius)
+      radius = distance;
+  }
+  out->radius = radius + padding;
+
+  // Average the triangle normals, then find the widest one from the average
+  float normals[MESHLET_MAX_TRIANGLES][3];
+  size_t normal_count = 0;
+  float axis[3] = {0.0f, 0.0f, 0.0f};
+
+  for (size_t i = 0; i + 2 < index_count; i += 3) {
+    const float *a = vertices[indices[i]].position;
+    const float *b = vertices[indices[i + 1]].position;
+    const float *c = vertices[indices[i + 2]].position;
+
+    float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    float n[3] = {
+        e1[1] * e2[2] - e1[2] * e2[1],
+        e1[2] * e2[0] - e1[0] * e2[2],
+        e1[0] * e2[1] - e1[1] * e2[0],
+    };
+
+    float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0.0f)
+      continue; // degenerate triangles face nowhere
+
+    for (int k = 0; k < 3; k++) {
+      normals[normal_count][k] = n[k] / length;
+      axis[k] += n[k] / length;
+    }
+    normal_count++;
+  }
+
+  float length =
+      sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+  out->cone_axis[0] = out->cone_axis[1] = out->cone_axis[2] = 0.0f;
+  out->cone_cutoff = 1.0f;
+  if (normal_count == 0 || length < 1e-6f)
+    return;
+
+  float min_dot = 1.0f;
+  for (size_t i = 0; i < normal_count; i++) {
+    float dot = (normals[i][0] * axis[0] + normals[i][1] * axis[1]
+                 + normals[i][2] * axis[2])
+              / length;
+    if (dot < min_dot)
+      min_dot = dot;
+  }
+
+  // Normals spread over more than a hemisphere, some triangle always faces
+  // the camera
+  if (min_dot <= 0.0f)
+    return;
+
+  for (int k = 0; k < 3; k++)
+    out->cone_axis[k] = axis[k] / length;
+  out->cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+}
+
+// Splits LOD 0 of every submesh into meshlets, has to run on the imported
+// (unpacked) scene after optimize_scene
+void build_scene_meshlets(
+    struct imported_scene *scene,
+    struct arena *scratch
+) {
+  struct meshlet *list = NULL;
+  size_t count = 0, capacity = 0, triangles = 0;
+  struct arena_mark mark = arena_mark(scratch);
+
+  // Which meshlet saw a vertex last, meshlet numbers are unique across the
+  // scene so this never needs to be cleared
+  uint32_t *seen =
+      arena_alloc(scratch, sizeof(uint32_t) * (scene->vertex_count + 1));
+  memset(seen, 0xff, sizeof(uint32_t) * (scene->vertex_count + 1));
+
+  for (unsigned int i = 0; i < scene->submesh_count; i++) {
+    struct scene_submesh *submesh = &scene->submeshes[i];
+    const struct mesh_vertex *vertices = scene->vertices + submesh->base_vertex;
+    const uint32_t *indices = scene->indices + submesh->first_index;
+    uint32_t *submesh_seen = seen + submesh->base_vertex;
+    size_t index_count = (size_t) submesh->index_count;
+
+    // Quantized positions can be off by half a step, keep the spheres around
+    // what actually gets drawn
+    float padding = 0.0f;
+    for (int axis = 0; axis < 3; axis++) {
+      float extent = submesh->bounds_max[axis] - submesh->bounds_min[axis];
+      padding += extent * extent;
+    }
+    padding = sqrtf(padding) / 65535.0f;
+
+    submesh->first_meshlet = (unsigned int) count;
+    triangles += index_count / 3;
+
+    size_t start = 0;
+    unsigned int vertex_count = 0;
+    for (size_t t = 0; t <= index_count; t += 3) {
+      unsigned int new_vertices = 0;
+      for (size_t k = 0; t < index_count && k < 3; k++)
+        new_vertices += submesh_seen[indices[t + k]] != (uint32_t) count;
+
+      int full = (t - start) / 3 == MESHLET_MAX_TRIANGLES
+              || vertex_count + new_vertices > MESHLET_MAX_VERTICES;
+      if (t > start && (t == index_count || full)) {
+        if (count == capacity) {
+          capacity = capacity ? capacity * 2 : 256;
+          list = realloc(list, sizeof(struct meshlet) * capacity);
+        }
+
+        struct meshlet *meshlet = &list[count++];
+        compute_meshlet_bounds(
+            vertices,
+            indices + start,
+            t - start,
+            padding,
+            meshlet
+        );
+        meshlet->first_index = submesh->first_index + (uint32_t) start;
+        meshlet->index_count = (uint32_t) (t - start);
+
+        start = t;
+        vertex_count = 0;
+      }
+
+      for (size_t k = 0; t < index_count && k < 3; k++) {
+        if (submesh_seen[indices[t + k]] != (uint32_t) count) {
+          submesh_seen[indices[t + k]] = (uint32_t) count;
+          vertex_count++;
+        }
+      }
+    }
+
+    submesh->meshlet_count = (unsigned int) count - submesh->first_meshlet;
+  }
+
+  if (count) {
+    printf(
+        "Meshlets: %zu, %.1f triangles each\n",
+        count,
+        (double) triangles / (double) count
+    );
+  }
+
+  store_scene_meshlets(scene, list, count);
+  free(list);
+  arena_rewind(scratch, mark);
+}
+
+struct meshlet_cull_job {
+  const struct scene_meshlets *meshlets;
+  struct frustum frustum; // model space
+  float camera[3];        // model space
+  int cone_culling;
+};
+
+// Bit k is set if meshlet i + k faces away from the camera: its normal cone
+// lies entirely on the far side of the camera to sphere direction
+static int meshlet_cone_mask(
+    const struct scene_meshlets *m,
+    const float *camera,
+    size_t i
+) {
+#if defined(MESHLET_SSE)
+  __m128 vx = _mm_sub_ps(_mm_loadu_ps(m->center_x + i), _mm_set1_ps(camera[0]));
+  __m128 vy = _mm_sub_ps(_mm_loadu_ps(m->center_y + i), _mm_set1_ps(camera[1]));
+  __m128 vz = _mm_sub_ps(_mm_loadu_ps(m->center_z + i), _mm_set1_ps(camera[2]));
+  __m128 length = _mm_sqrt_ps(_mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)),
+      _mm_mul_ps(vz, vz)
+  ));
+  __m128 dot = _mm_add_ps(
+      _mm_add_ps(
+          _mm_mul_ps(vx, _mm_loadu_ps(m->cone_x + i)),
+          _mm_mul_ps(vy, _mm_loadu_ps(m->cone_y + i))
+      ),
+      _mm_mul_ps(vz, _mm_loadu_ps(m->cone_z + i))
+  );
+  __m128 limit = _mm_add_ps(
+      _mm_mul_ps(_mm_loadu_ps(m->cone_cutoff + i), length),
+      _mm_loadu_ps(m->radius + i)
+  );
+  return _mm_movemask_ps(_mm_cmpge_ps(dot, limit));
+#elif defined(MESHLET_NEON)
+  float32x4_t vx =
+      vsubq_f32(vld1q_f32(m->center_x + i), vdupq_n_f32(camera[0]));
+  float32x4_t vy =
+      vsubq_f32(vld1q_f32(m->center_y + i), vdupq_n_f32(camera[1]));
+  float32x4_t vz =
+      vsubq_f32(vld1q_f32(m->center_z + i), vdupq_n_f32(camera[2]));
+
+  float32x4_t squared = vmulq_f32(vx, vx);
+  squared = vmlaq_f32(squared, vy, vy);
+  squared = vmlaq_f32(squared, vz, vz);
+  float lanes[4];
+  vst1q_f32(lanes, squared);
+  for (int k = 0; k < 4; k++)
+    lanes[k] = sqrtf(lanes[k]);
+  float32x4_t length = vld1q_f32(lanes);
+
+  float32x4_t dot = vmulq_f32(vx, vld1q_f32(m->cone_x + i));
+  dot = vmlaq_f32(dot, vy, vld1q_f32(m->cone_y + i));
+  dot = vmlaq_f32(dot, vz, vld1q_f32(m->cone_z + i));
+  float32x4_t limit = vmlaq_f32(
+      vld1q_f32(m->radius + i),
+      vld1q_f32(m->cone_cutoff + i),
+      length
+  );
+
+  uint32_t mask[4];
+  vst1q_u32(mask, vcgeq_f32(dot, limit));
+  return (mask[0] & 1) | (mask[1] & 2) | (mask[2] & 4) | (mask[3] & 8);
+#else
+  int mask = 0;
+  for (size_t k = 0; k < 4; k++) {
+    size_t j = i + k;
+    float vx = m->center_x[j] - camera[0], vy = m->center_y[j] - camera[1],
+          vz = m->center_z[j] - camera[2];
+    float length = sqrtf(vx * vx + vy * vy + vz * vz);
+    float dot = vx * m->cone_x[j] + vy * m->cone_y[j] + vz * m->cone_z[j];
+    mask |= (dot >= m->cone_cutoff[j] * length + m->radius[j]) << k;
+  }
+  return mask;
+#endif
+}
+
+// Writes visible[] for meshlets [begin, end), begin and end are multiples of 4
+static void cull_meshlet_batch(void *data, size_t begin, size_t end) {
+  const struct meshlet_cull_job *job = data;
+  const struct scene_meshlets *m = job->meshlets;
+
+  for (size_t i = begin; i < end; i += 4) {
+    int visible = frustum_test_spheres4(
+        &job->frustum,
+        m->center_x + i,
+        m->center_y + i,
+        m->center_z + i,
+        m->radius + i
+    );
+    if (job->cone_culling && visible)
+      visible &= ~meshlet_cone_mask(m, job->camera, i);
+
+    for (int k = 0; k < 4; k++)
+      m->visible[i + k] = (visible >> k) & 1;
+  }
+}
+
+// Solves model_view * p = (0, 0, 0, 1), the camera in model space. Returns 0
+// if the matrix can't be inverted.
+static int meshlet_camera_position(const float *model_view, float *camera) {
+  float m[4][5];
+  for (int row = 0; row < 4; row++) {
+    for (int col = 0; col < 4; col++)
+      m[row][col] = model_view[col * 4 + row];
+    m[row][4] = row == 3 ? 1.0f : 0.0f;
+  }
+
+  for (int col = 0; col < 4; col++) {
+    int pivot = col;
+    for (int row = col + 1; row < 4; row++) {
+      if (fabsf(m[row][col]) > fabsf(m[pivot][col]))
+        pivot = row;
+    }
+    if (fabsf(m[pivot][col]) < 1e-12f)
+      return 0;
+
+    for (int k = 0; k < 5; k++) {
+      float swap = m[col][k];
+      m[col][k] = m[pivot][k];
+      m[pivot][k] = swap;
+    }
+
+    for (int row = 0; row < 4; row++) {
+      if (row == col)
+        continue;
+      float factor = m[row][col] / m[col][col];
+      for (int k = col; k < 5; k++)
+        m[row][k] -= factor * m[col][k];
+    }
+  }
+
+  float w = m[3][4] / m[3][3];
+  if (w == 0.0f)
+    return 0;
+  for (int axis = 0; axis < 3; axis++)
+    camera[axis] = m[axis][4] / m[axis][axis] / w;
+  return 1;
+}
+
+// Culls the meshlets of every submesh against the view frustum and the
+// camera direction, the visible index ranges are left in scene->meshlets for
+// draw_scene. The sphere/cone tests are spread over the job pool. The results
+// live in `frame`, which must not be reset before the scene was drawn.
+void cull_scene_meshlets(
+    struct imported_scene *scene,
+    struct job_pool *pool,
+    struct arena *frame,
+    const float *model,
+    const float *view,
+    const float *projection
+) {
+  struct scene_meshlets *meshlets = &scene->meshlets;
+  if (!meshlets->culling || meshlets->count == 0)
+    return;
+
+  size_t capacity = meshlets->capacity;
+  meshlets->visible = arena_alloc(frame, capacity);
+  meshlets->draw_counts = arena_alloc(frame, sizeof(GLsizei) * capacity);
+  meshlets->draw_offsets = arena_alloc(frame, sizeof(GLvoid *) * capacity);
+  meshlets->draw_base_vertices = arena_alloc(frame, sizeof(GLint) * capacity);
+
+  struct meshlet_cull_job job;
+  job.meshlets = meshlets;
+
+  float model_view[16];
+  mat4_multiply(model_view, view, model);
+  job.cone_culling = meshlet_camera_position(model_view, job.camera);
+
+  // Planes in model space, like the meshlet bounds
+  frustum_from_matrices(&job.frustum, model, view, projection);
+
+  job_pool_for(
+      pool,
+      meshlets->capacity,
+      MESHLET_CULL_BATCH,
+      cull_meshlet_batch,
+      &job
+  );
+
+  // Turn the visible meshlets into draws, neighbours merge into one range
+  size_t index_size =
+      scene->index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t)
+                                             : sizeof(uint32_t);
+  unsigned int draws = 0;
+  meshlets->visible_count = 0;
+
+  for (unsigned int i = 0; i < scene->submesh_count; i++) {
+    struct scene_submesh *submesh = &scene->submeshes[i];
+    submesh->first_draw = draws;
+
+    GLuint end = 0;
+    unsigned int last = submesh->first_meshlet + submesh->meshlet_count;
+    for (unsigned int j = submesh->first_meshlet; j < last; j++) {
+      if (!meshlets->visible[j] || meshlets->index_count[j] == 0)
+        continue;
+      meshlets->visible_count++;
+
+      if (draws > submesh->first_draw && end == meshlets->first_index[j]) {
+        meshlets->draw_counts[draws - 1] += meshlets->index_count[j];
+      } else {
+        meshlets->draw_counts[draws] = meshlets->index_count[j];
+        meshlets->draw_offsets[draws] =
+            (const GLvoid *) (meshlets->first_index[j] * index_size);
+        meshlets->draw_base_vertices[draws] = submesh->base_vertex;
+        draws++;
+      }
+      end = meshlets->first_index[j] + (GLuint) meshlets->index_count[j];
+    }
+
+    submesh->draw_count = draws - submesh->first_draw;
+  }
+}
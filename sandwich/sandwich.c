@@ -2,37 +2,42 @@
 #include <stdio.h>
 #include <stdlib.h>
 #define STB_IMAGE_IMPLEMENTATION
-#include <assimp/cimport.h>
-#include <assimp/postprocess.h>
-#include <assimp/scene.h>
 #include <glad/glad.h>
 
+#include "../common/camera.h"
+#include "../common/transform.h"
 #include "../stbi.h" // Include stb_image.h for texture loading
+#include "scene_culling.h"
+#include "scene_streamer.h"
 
-// Vertex Shader Source Code
+// C toggles frustum & meshlet culling, back faces are culled along with it
+static int culling = 1;
+
+// Vertex Shader Source Code, the inputs are the packed vertices described in
+// vertex_format.h
 const GLchar *vertex_shader_source =
     "#version 410 core\n"
     "layout (location = 0) in vec3 position;\n"
-    "layout (location = 1) in vec3 color;\n"
+    "layout (location = 1) in vec3 normal;\n"
     "layout (location = 2) in vec2 tex_coord;\n"
-    "out vec3 our_color;\n"
     "out vec2 our_tex_coord;\n"
     "uniform mat4 model;\n"
     "uniform mat4 view;\n"
     "uniform mat4 projection;\n"
+    "uniform vec3 dequant_offset;\n"
+    "uniform vec3 dequant_scale;\n"
     "uniform int width;\n"
     "uniform int height;\n"
     "void main()\n"
     "{\n"
-    "    gl_Position = projection * view * model * vec4(position, 1.0);\n"
-    "    our_color = color;\n"
+    "    vec3 local = dequant_offset + position * dequant_scale;\n"
+    "    gl_Position = projection * view * model * vec4(local, 1.0);\n"
     "    our_tex_coord = tex_coord;\n"
     "}\n";
 
 // Fragment Shader Source Code
 const GLchar *fragment_shader_source =
     "#version 410 core\n"
-    "in vec3 our_color;\n"
     "in vec2 our_tex_coord;\n"
     "out vec4 color;\n"
     "uniform sampler2D texture1;\n"
@@ -43,7 +48,7 @@ const GLchar *fragment_shader_source =
     "    vec2 resolution = vec2(width, height);\n"
     "    vec2 block_size = resolution / 3.4;\n"
     "    vec2 uv = floor((our_tex_coord + 0.5) * block_size) / block_size - 0.5;\n"
-    "    color = texture(texture1, uv) * vec4(our_color, 1.0);\n"
+    "    color = texture(texture1, uv);\n"
     "}\n";
 
 void sdl_die(const char *message) {
@@ -67,15 +72,52 @@ GLuint compile_shader(GLenum shader_type, const GLchar *source) {
   return shader;
 }
 
-void process_input(SDL_Event *event, int *running) {
+// Returns 1 if the window was resized
+int process_input(
+    SDL_Event *event,
+    int *running,
+    struct camera *camera,
+    SDL_Window *window
+) {
+  int resized = 0;
   while (SDL_PollEvent(event)) {
+    resized |= camera_handle_event(camera, window, event);
+
     if (event->type == SDL_QUIT) {
       *running = 0;
+    } else if (event->type == SDL_KEYDOWN
+               && event->key.keysym.sym == SDLK_c) {
+      culling = !culling;
+      printf("Culling %s\n", culling ? "on" : "off");
     }
   }
+  return resized;
+}
+
+// Prints what survived the culling every couple of seconds
+void report_culling(const struct imported_scene *scene, uint32_t *last_report) {
+  if (!culling || SDL_GetTicks() - *last_report < 2000)
+    return;
+  *last_report = SDL_GetTicks();
+
+  unsigned int submeshes = scene->visible_submeshes
+                             ? scene->visible_submesh_count
+                             : scene->submesh_count;
+  printf(
+      "Visible: %u of %u submeshes (%u culled), %zu of %zu meshlets\n",
+      submeshes,
+      scene->submesh_count,
+      scene->submesh_count - submeshes,
+      scene->meshlets.visible_count,
+      scene->meshlets.count
+  );
 }
 
-void setup_matrix(GLuint shader_program, const char *name, float *matrix) {
+void setup_matrix(
+    GLuint shader_program,
+    const char *name,
+    const float *matrix
+) {
   GLuint location = glGetUniformLocation(shader_program, name);
   glUniformMatrix4fv(location, 1, GL_FALSE, matrix);
 }
@@ -85,50 +127,6 @@ void setup_int(GLuint shader, const char *name, int num) {
   glUniform1i(location, num);
 }
 
-void multiply_matrices(float *result, const float *mat1, const float *mat2) {
-  for (int row = 0; row < 4; ++row) {
-    for (int col = 0; col < 4; ++col) {
-      result[row * 4 + col] = 0;
-      for (int k = 0; k < 4; ++k) {
-        result[row * 4 + col] += mat1[row * 4 + k] * mat2[k * 4 + col];
-      }
-    }
-  }
-}
-
-void rotate_matrix(float *matrix, float angle, float x, float y, float z) {
-  float c = cos(angle);
-  float s = sin(angle);
-  float axis_length = sqrt(x * x + y * y + z * z);
-  x /= axis_length;
-  y /= axis_length;
-  z /= axis_length;
-
-  float rotation[16] = {
-      c + (1 - c) * x * x,
-      (1 - c) * x * y - s * z,
-      (1 - c) * x * z + s * y,
-      0.0f,
-      (1 - c) * y * x + s * z,
-      c + (1 - c) * y * y,
-      (1 - c) * y * z - s * x,
-      0.0f,
-      (1 - c) * z * x - s * y,
-      (1 - c) * z * y + s * x,
-      c + (1 - c) * z * z,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      1.0f
-  };
-
-  float result[16];
-  multiply_matrices(result, matrix, rotation);
-  for (int i = 0; i < 16; i++)
-    matrix[i] = result[i];
-}
-
 GLuint load_texture(const char *path) {
   //stbi_set_flip_vertically_on_load(1);
 
@@ -166,48 +164,6 @@ GLuint load_texture(const char *path) {
   return texture;
 }
 
-const struct aiScene *scene;
-struct aiMesh *mesh;
-
-float *load_vertices(int *size) {
-  scene = aiImportFile("model.obj", aiProcess_Triangulate | aiProcess_FlipUVs);
-  mesh = scene->mMeshes[0];
-
-  *size = mesh->mNumVertices;
-
-  float *vertices = malloc(sizeof(float) * mesh->mNumVertices * 8);
-  for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-    struct aiVector3D vert = mesh->mVertices[i],
-                      tex = mesh->mTextureCoords[0][i];
-
-    vertices[i * 8 + 0] = vert.x;
-    vertices[i * 8 + 1] = vert.y;
-    vertices[i * 8 + 2] = vert.z;
-
-    vertices[i * 8 + 3] = vertices[i * 8 + 4] = vertices[i * 8 + 5] = 1.0;
-
-    vertices[i * 8 + 6] = tex.x;
-    vertices[i * 8 + 7] = tex.y;
-  }
-
-  return vertices;
-}
-
-uint32_t *load_indices(int *size) {
-  *size = mesh->mNumFaces * 3;
-  uint32_t *indices = malloc(sizeof(int) * (*size));
-
-  for (int i = 0; i < *size; i += 3) {
-    indices[i] = mesh->mFaces[i / 3].mIndices[0];
-    indices[i + 1] = mesh->mFaces[i / 3].mIndices[1];
-    indices[i + 2] = mesh->mFaces[i / 3].mIndices[2];
-  }
-
-  aiReleaseImport(scene);
-
-  return indices;
-}
-
 int main(void) {
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     sdl_die("Couldn't initialize SDL");
@@ -265,73 +221,33 @@ int main(void) {
   glDeleteShader(vertex_shader);
   glDeleteShader(fragment_shader);
 
-  // Set up vertex data (Cube vertices with color and texture coordinates)
-  int size;
-  GLfloat *vertices = load_vertices(&size);
-  printf("%d\n", size);
-
+  // Set up vertex data, all meshes of the model share one VBO & EBO. The
+  // model is loaded on a worker thread and uploaded over the first frames,
+  // model.cooked is used instead of model.obj whenever it is up to date.
   GLuint VAO, VBO, EBO;
   glGenVertexArrays(1, &VAO);
   glGenBuffers(1, &VBO);
   glGenBuffers(1, &EBO);
 
-  glBindVertexArray(VAO);
-
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  glBufferData(
-      GL_ARRAY_BUFFER,
-      sizeof(float) * size * 8,
-      vertices,
-      GL_STATIC_DRAW
-  );
+  struct imported_scene scene;
+  memset(&scene, 0, sizeof(scene));
+  int materials_loaded = 0;
 
-  GLuint *indices = load_indices(&size);
+  struct scene_streamer streamer;
+  start_scene_streamer(&streamer, "model.obj", "model.cooked");
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-  glBufferData(
-      GL_ELEMENT_ARRAY_BUFFER,
-      size * sizeof(uint32_t),
-      indices,
-      GL_STATIC_DRAW
-  );
+  // Worker threads for meshlet culling
+  struct job_pool pool;
+  init_job_pool(&pool, 0);
 
-  // Position attribute
-  glVertexAttribPointer(
-      0,
-      3,
-      GL_FLOAT,
-      GL_FALSE,
-      8 * sizeof(GLfloat),
-      (GLvoid *) 0
-  );
-  glEnableVertexAttribArray(0);
-
-  // Color attribute
-  glVertexAttribPointer(
-      1,
-      3,
-      GL_FLOAT,
-      GL_FALSE,
-      8 * sizeof(GLfloat),
-      (GLvoid *) (3 * sizeof(GLfloat))
-  );
-  glEnableVertexAttribArray(1);
-
-  // Texture Coord attribute
-  glVertexAttribPointer(
-      2,
-      2,
-      GL_FLOAT,
-      GL_FALSE,
-      8 * sizeof(GLfloat),
-      (GLvoid *) (6 * sizeof(GLfloat))
-  );
-  glEnableVertexAttribArray(2);
+  // Scratch memory that only lives for one frame
+  struct arena frame_arena;
+  init_arena(&frame_arena, 0);
 
-  glBindVertexArray(0);
-
-  free(indices);
-  free(vertices);
+  // The model is the only node so far
+  struct transform_graph graph;
+  init_transform_graph(&graph);
+  uint32_t model_node = add_transform_node(&graph, TRANSFORM_NO_PARENT);
 
   // Load and create a texture
   GLuint texture = load_texture("texture.png");
@@ -342,25 +258,6 @@ int main(void) {
   ); // set the texture as sampler2D 0
 
   // Transformation matrices
-  float model[16] = {
-      1.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      1.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      1.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      1.0f,
-  };
-
   float view[16] = {
       0.25f,
       0.0f,
@@ -380,24 +277,23 @@ int main(void) {
       0.25f
   };
 
-  float projection[16] = {
+  // The field of view the hard-coded projection had, with reverse Z if the
+  // driver supports it
+  struct camera camera;
+  init_perspective_camera(
+      &camera,
+      window,
+      2.0f * atanf(0.75f),
       1.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      1.3333f,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      -1.02f,
-      -1.0f,
-      0.0f,
-      0.0f,
-      -2.02f,
-      0.0f
-  };
+      101.0f,
+      1
+  );
+  const float *projection = camera.projection;
+
+  // These only change when the window does
+  setup_matrix(shader_program, "projection", projection);
+  setup_int(shader_program, "width", camera.window_width);
+  setup_int(shader_program, "height", camera.window_height);
 
   // Main loop
   SDL_Event event;
@@ -405,10 +301,34 @@ int main(void) {
   float angle = 0.0f;
 
   uint32_t start = SDL_GetTicks();
+  uint32_t last_report = start;
   glClearColor(0.2f, 0.5f, 0.7f, 1.0f);
 
   while (running) {
-    process_input(&event, &running);
+    arena_reset(&frame_arena);
+    if (process_input(&event, &running, &camera, window)) {
+      glUseProgram(shader_program);
+      setup_matrix(shader_program, "projection", projection);
+      setup_int(shader_program, "width", camera.window_width);
+      setup_int(shader_program, "height", camera.window_height);
+    }
+
+    // Upload whatever the loader finished since the last frame
+    if (update_scene_streamer(&streamer, &scene, VAO, VBO, EBO)
+        == STREAM_ERROR) {
+      printf("Failed to import model.obj\n");
+      running = 0;
+    }
+
+    // Materials with their own diffuse texture get it loaded here
+    if (scene.materials && !materials_loaded) {
+      for (unsigned int i = 0; i < scene.material_count; i++) {
+        if (scene.materials[i].texture_path[0])
+          scene.materials[i].texture =
+              load_texture(scene.materials[i].texture_path);
+      }
+      materials_loaded = 1;
+    }
 
     // Update model matrix to rotate
     uint32_t curr = SDL_GetTicks();
@@ -420,28 +340,15 @@ int main(void) {
     if (angle > 360.0f)
       angle -= 360.0f;
 
-    // Identity matrix
-    model[0] = 0.1f;
-    model[4] = 0.0f;
-    model[8] = 0.0f;
-    model[12] = 0.0f;
-    model[1] = 0.0f;
-    model[5] = 0.1f;
-    model[9] = 0.0f;
-    model[13] = 0.0f;
-    model[2] = 0.0f;
-    model[6] = 0.0f;
-    model[10] = 0.1f;
-    model[14] = 0.0f;
-    model[3] = 0.0f;
-    model[7] = 0.0f;
-    model[11] = 0.0f;
-    model[15] = 0.1f;
-
-    // Apply rotation around Y axis
-    rotate_matrix(model, angle, 0.0f, 1.0f, 0.0f);
-
-    // Render
+    // Spin clockwise around the Y axis
+    float rotation[4];
+    quat_from_axis_angle(rotation, -angle, 0.0f, 1.0f, 0.0f);
+    set_transform_rotation(&graph, model_node, rotation);
+    update_transform_graph(&graph, &pool);
+    const float *model = transform_world(&graph, model_node);
+
+    // Render, into the camera's float depth target with reverse Z
+    begin_camera_frame(&camera);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     glUseProgram(shader_program);
@@ -449,22 +356,38 @@ int main(void) {
     // Set transformation matrices
     setup_matrix(shader_program, "model", model);
     setup_matrix(shader_program, "view", view);
-    setup_matrix(shader_program, "projection", projection);
 
-    int x, y;
-    SDL_GetWindowSize(window, &x, &y);
+    // Distant or small objects switch to a coarser LOD
+    select_scene_lods(&scene, model, view, projection, camera.height);
 
-    setup_int(shader_program, "width", x);
-    setup_int(shader_program, "height", y);
+    // Only submeshes inside the frustum get drawn, and of those only the
+    // meshlets inside it facing the camera
+    if (culling)
+      cull_scene_submeshes(&scene, &frame_arena, model, view, projection);
+    else
+      scene.visible_submeshes = NULL;
 
-    // Bind texture
+    scene.meshlets.culling = culling;
+    cull_scene_meshlets(&scene, &pool, &frame_arena, model, view, projection);
+    if (culling)
+      glEnable(GL_CULL_FACE);
+    else
+      glDisable(GL_CULL_FACE);
+
+    // Textures are bound per material by draw_scene
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
 
     // Draw the object
     glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, size, GL_UNSIGNED_INT, 0);
+    draw_scene(
+        &scene,
+        texture,
+        glGetUniformLocation(shader_program, "dequant_offset"),
+        glGetUniformLocation(shader_program, "dequant_scale")
+    );
     glBindVertexArray(0);
+    report_culling(&scene, &last_report);
+    end_camera_frame(&camera);
 
     SDL_GL_SwapWindow(window);
 
@@ -477,6 +400,13 @@ int main(void) {
   glDeleteBuffers(1, &EBO);
   glDeleteProgram(shader_program);
   glDeleteTextures(1, &texture);
+  free_camera(&camera);
+  stop_scene_streamer(&streamer);
+  free_scene(&scene);
+  free_transform_graph(&graph);
+  destroy_job_pool(&pool);
+  print_arena_stats(&frame_arena, "Frame arena");
+  free_arena(&frame_arena);
 
   SDL_GL_DeleteContext(context);
   SDL_DestroyWindow(window);
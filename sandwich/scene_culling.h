@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "../common/arena.h"
+#include "../common/frustum.h"
+#include "scene_import.h"
+
+// Whole submeshes are tested against the view frustum by their bounding
+// boxes, the ones that survive end up in scene->visible_submeshes for
+// draw_scene. The meshlet culling in meshlets.h then works on what's left.
+
+// The list lives in `frame`, which must not be reset before the scene was
+// drawn
+void cull_scene_submeshes(
+    struct imported_scene *scene,
+    struct arena *frame,
+    const float *model,
+    const float *view,
+    const float *projection
+) {
+  unsigned int count = scene->submesh_count;
+  float *bounds = arena_alloc(frame, sizeof(float) * 6 * count);
+  uint32_t *visible = arena_alloc(frame, sizeof(uint32_t) * count);
+  if (!bounds || !visible) {
+    scene->visible_submeshes = NULL;
+    return;
+  }
+
+  // Centers then half extents, one array per axis
+  for (unsigned int i = 0; i < count; i++) {
+    const struct scene_submesh *submesh = &scene->submeshes[i];
+    for (int axis = 0; axis < 3; axis++) {
+      float min = submesh->bounds_min[axis], max = submesh->bounds_max[axis];
+      bounds[axis * count + i] = (min + max) * 0.5f;
+      bounds[(axis + 3) * count + i] = (max - min) * 0.5f;
+    }
+  }
+
+  // Bounds are in model space, so are the planes
+  struct frustum frustum;
+  frustum_from_matrices(&frustum, model, view, projection);
+
+  scene->visible_submeshes = visible;
+  scene->visible_submesh_count = (unsigned int) frustum_cull_boxes(
+      &frustum,
+      bounds,
+      bounds + count,
+      bounds + count * 2,
+      bounds + count * 3,
+      bounds + count * 4,
+      bounds + count * 5,
+      count,
+      visible
+  );
+}
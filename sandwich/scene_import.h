@@ -0,0 +1,486 @@
+#pragma once
+
+#include <assimp/cimport.h>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <glad/glad.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file_map.h"
+
+// Every mesh of the aiScene is packed into one vertex and one index buffer.
+// Indices stay local to their mesh, a submesh remembers where its vertices
+// start (base_vertex) and where its indices start (first_index), so the whole
+// scene is drawn from a single VAO with glDrawElementsBaseVertex.
+
+// Full precision vertex produced by the importer, see vertex_format.h for
+// the compact layout that is actually uploaded
+struct mesh_vertex {
+  float position[3];
+  float normal[3];
+  float tex_coord[2];
+};
+
+#define SCENE_MAX_LODS 4
+
+// A range of the shared index buffer, error is how far (in object space) the
+// simplified surface may be from the original one
+struct scene_lod {
+  GLuint first_index;
+  GLsizei index_count;
+  float error;
+};
+
+struct scene_submesh {
+  GLint base_vertex;
+  GLuint first_index; // full detail range, the same as lods[0]
+  GLsizei index_count;
+  unsigned int material;
+
+  // Object space bounds, quantized positions are relative to these
+  float bounds_min[3], bounds_max[3];
+
+  struct scene_lod lods[SCENE_MAX_LODS];
+  unsigned int lod_count;
+  unsigned int current_lod; // picked every frame by select_scene_lods
+
+  // LOD 0 is split into meshlets, see meshlets.h
+  unsigned int first_meshlet, meshlet_count;
+  // Visible index ranges left by cull_scene_meshlets this frame
+  unsigned int first_draw, draw_count;
+};
+
+// Meshlet bounds as a structure of arrays, so the culling loop can test 4
+// meshlets at a time. The arrays are padded to a multiple of 4, padding
+// meshlets have no indices. The bounds live in one allocation, the culling
+// results in the frame arena passed to cull_scene_meshlets.
+struct scene_meshlets {
+  size_t count, capacity;
+  void *storage;
+
+  GLuint *first_index;
+  GLsizei *index_count;
+  float *center_x, *center_y, *center_z, *radius;
+  float *cone_x, *cone_y, *cone_z, *cone_cutoff;
+
+  // Per frame culling results, one entry per glMultiDrawElementsBaseVertex
+  // draw, adjacent visible meshlets are merged into one draw
+  unsigned char *visible;
+  GLsizei *draw_counts;
+  const GLvoid **draw_offsets;
+  GLint *draw_base_vertices;
+  size_t visible_count;
+
+  int culling; // draw_scene only uses the culled draws while this is set
+};
+
+struct scene_material {
+  char texture_path[256]; // empty if the material has no diffuse texture
+  GLuint texture;
+};
+
+struct imported_scene {
+  // Only present right after an import, a cooked scene has just the packed
+  // vertices and indices
+  struct mesh_vertex *vertices;
+  uint32_t *indices;
+  size_t vertex_count, index_count;
+
+  // What goes into the VBO & EBO
+  void *packed_vertices;
+  void *packed_indices;
+  GLenum index_type; // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+
+  struct scene_submesh *submeshes;
+  unsigned int submesh_count;
+
+  struct scene_material *materials;
+  unsigned int material_count;
+
+  struct scene_meshlets meshlets;
+
+  // Submeshes inside the view frustum this frame, in draw order. NULL draws
+  // all of them, see cull_scene_submeshes.
+  const uint32_t *visible_submeshes;
+  unsigned int visible_submesh_count;
+
+  // How much of the packed data is already in the GPU buffers, submeshes are
+  // only drawn once all of their vertices and indices are resident
+  size_t resident_vertices, resident_indices;
+
+  // Set when the packed data points into a mapped cooked mesh file
+  void *mapping;
+  size_t mapping_size;
+};
+
+// A mesh referenced by a node, with the node's accumulated transform
+struct scene_mesh_ref {
+  unsigned int mesh;
+  struct aiMatrix4x4 transform;
+};
+
+static struct aiMatrix4x4
+scene_multiply_transforms(struct aiMatrix4x4 a, struct aiMatrix4x4 b) {
+  const float *x = &a.a1, *y = &b.a1;
+  struct aiMatrix4x4 result;
+  float *r = &result.a1;
+
+  for (int row = 0; row < 4; ++row) {
+    for (int col = 0; col < 4; ++col) {
+      r[row * 4 + col] = 0;
+      for (int k = 0; k < 4; ++k) {
+        r[row * 4 + col] += x[row * 4 + k] * y[k * 4 + col];
+      }
+    }
+  }
+
+  return result;
+}
+
+static unsigned int scene_count_mesh_refs(const struct aiNode *node) {
+  unsigned int count = node->mNumMeshes;
+  for (unsigned int i = 0; i < node->mNumChildren; i++)
+    count += scene_count_mesh_refs(node->mChildren[i]);
+  return count;
+}
+
+static void scene_collect_mesh_refs(
+    const struct aiNode *node,
+    struct aiMatrix4x4 parent,
+    struct scene_mesh_ref *refs,
+    unsigned int *count
+) {
+  struct aiMatrix4x4 transform =
+      scene_multiply_transforms(parent, node->mTransformation);
+
+  for (unsigned int i = 0; i < node->mNumMeshes; i++) {
+    refs[*count].mesh = node->mMeshes[i];
+    refs[*count].transform = transform;
+    (*count)++;
+  }
+
+  for (unsigned int i = 0; i < node->mNumChildren; i++)
+    scene_collect_mesh_refs(node->mChildren[i], transform, refs, count);
+}
+
+// Sort mesh references by material so every material is one run of draws
+static void scene_sort_mesh_refs(
+    const struct aiScene *scene,
+    struct scene_mesh_ref *refs,
+    unsigned int count
+) {
+  // Insertion sort keeps the node order within a material
+  for (unsigned int i = 1; i < count; i++) {
+    struct scene_mesh_ref ref = refs[i];
+    unsigned int material = scene->mMeshes[ref.mesh]->mMaterialIndex;
+    unsigned int j = i;
+
+    while (j > 0
+           && scene->mMeshes[refs[j - 1].mesh]->mMaterialIndex > material) {
+      refs[j] = refs[j - 1];
+      j--;
+    }
+    refs[j] = ref;
+  }
+}
+
+static void scene_load_materials(
+    const struct aiScene *scene,
+    struct imported_scene *out
+) {
+  out->material_count = scene->mNumMaterials;
+  out->materials = calloc(scene->mNumMaterials, sizeof(struct scene_material));
+
+  for (unsigned int i = 0; i < scene->mNumMaterials; i++) {
+    struct aiString path;
+    if (aiGetMaterialTexture(
+            scene->mMaterials[i],
+            aiTextureType_DIFFUSE,
+            0,
+            &path,
+            NULL,
+            NULL,
+            NULL,
+            NULL,
+            NULL,
+            NULL
+        )
+        != aiReturn_SUCCESS)
+      continue;
+
+    // A path that doesn't fit would be cut short and fail to load later
+    char *texture_path = out->materials[i].texture_path;
+    if (path.length >= sizeof(out->materials[i].texture_path)) {
+      printf("Texture path of material %u is too long, skipped\n", i);
+      continue;
+    }
+
+    // Only use textures that actually exist next to the model
+    FILE *file = fopen(path.data, "rb");
+    if (!file)
+      continue;
+    fclose(file);
+
+    memcpy(texture_path, path.data, path.length);
+    texture_path[path.length] = '\0';
+  }
+}
+
+// Submeshes are stored back to back, so the vertices of one end where the
+// next one begins
+size_t scene_submesh_vertex_count(
+    const struct imported_scene *scene,
+    unsigned int submesh
+) {
+  size_t end = submesh + 1 < scene->submesh_count
+                 ? (size_t) scene->submeshes[submesh + 1].base_vertex
+                 : scene->vertex_count;
+  return end - scene->submeshes[submesh].base_vertex;
+}
+
+int import_scene(const char *path, struct imported_scene *out) {
+  memset(out, 0, sizeof(*out));
+
+  // OBJ faces come in with a vertex per corner, joining the identical ones
+  // is what gives the vertex cache optimizer shared vertices to work with.
+  // Missing normals are generated smooth, flat ones would differ per face
+  // and keep every corner apart again.
+  const struct aiScene *scene = aiImportFile(
+      path,
+      aiProcess_Triangulate | aiProcess_JoinIdenticalVertices
+          | aiProcess_FlipUVs | aiProcess_GenSmoothNormals
+  );
+  if (!scene || !scene->mRootNode)
+    return 0;
+
+  unsigned int ref_count = scene_count_mesh_refs(scene->mRootNode);
+  struct scene_mesh_ref *refs = malloc(sizeof(*refs) * (ref_count + 1));
+  struct aiMatrix4x4 identity =
+      {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+
+  ref_count = 0;
+  scene_collect_mesh_refs(scene->mRootNode, identity, refs, &ref_count);
+  scene_sort_mesh_refs(scene, refs, ref_count);
+
+  // Size the shared buffers
+  for (unsigned int i = 0; i < ref_count; i++) {
+    const struct aiMesh *mesh = scene->mMeshes[refs[i].mesh];
+    out->vertex_count += mesh->mNumVertices;
+    for (unsigned int f = 0; f < mesh->mNumFaces; f++) {
+      if (mesh->mFaces[f].mNumIndices == 3)
+        out->index_count += 3;
+    }
+  }
+
+  out->vertices = malloc(sizeof(struct mesh_vertex) * (out->vertex_count + 1));
+  out->indices = malloc(sizeof(uint32_t) * (out->index_count + 1));
+  out->submeshes = calloc(ref_count + 1, sizeof(struct scene_submesh));
+
+  size_t base_vertex = 0, first_index = 0;
+  for (unsigned int i = 0; i < ref_count; i++) {
+    const struct aiMesh *mesh = scene->mMeshes[refs[i].mesh];
+    const struct aiMatrix4x4 *t = &refs[i].transform;
+    struct mesh_vertex *vertices = out->vertices + base_vertex;
+
+    for (unsigned int v = 0; v < mesh->mNumVertices; v++) {
+      struct aiVector3D vert = mesh->mVertices[v];
+      float *position = vertices[v].position;
+
+      position[0] = t->a1 * vert.x + t->a2 * vert.y + t->a3 * vert.z + t->a4;
+      position[1] = t->b1 * vert.x + t->b2 * vert.y + t->b3 * vert.z + t->b4;
+      position[2] = t->c1 * vert.x + t->c2 * vert.y + t->c3 * vert.z + t->c4;
+
+      // Normals only get the rotation/scale part, renormalized afterwards
+      float *normal = vertices[v].normal;
+      normal[0] = normal[1] = normal[2] = 0.0f;
+      if (mesh->mNormals) {
+        struct aiVector3D n = mesh->mNormals[v];
+        normal[0] = t->a1 * n.x + t->a2 * n.y + t->a3 * n.z;
+        normal[1] = t->b1 * n.x + t->b2 * n.y + t->b3 * n.z;
+        normal[2] = t->c1 * n.x + t->c2 * n.y + t->c3 * n.z;
+
+        float length = sqrtf(
+            normal[0] * normal[0] + normal[1] * normal[1]
+            + normal[2] * normal[2]
+        );
+        if (length > 0.0f) {
+          normal[0] /= length;
+          normal[1] /= length;
+          normal[2] /= length;
+        }
+      }
+
+      if (mesh->mTextureCoords[0]) {
+        vertices[v].tex_coord[0] = mesh->mTextureCoords[0][v].x;
+        vertices[v].tex_coord[1] = mesh->mTextureCoords[0][v].y;
+      } else {
+        vertices[v].tex_coord[0] = vertices[v].tex_coord[1] = 0.0f;
+      }
+    }
+
+    struct scene_submesh *submesh = &out->submeshes[out->submesh_count++];
+    submesh->base_vertex = (GLint) base_vertex;
+    submesh->first_index = (GLuint) first_index;
+    submesh->material = mesh->mMaterialIndex;
+
+    // Points and lines survive aiProcess_Triangulate, skip them
+    for (unsigned int f = 0; f < mesh->mNumFaces; f++) {
+      const struct aiFace *face = &mesh->mFaces[f];
+      if (face->mNumIndices != 3)
+        continue;
+
+      out->indices[first_index++] = face->mIndices[0];
+      out->indices[first_index++] = face->mIndices[1];
+      out->indices[first_index++] = face->mIndices[2];
+    }
+
+    submesh->index_count = (GLsizei) (first_index - submesh->first_index);
+    submesh->lods[0].first_index = submesh->first_index;
+    submesh->lods[0].index_count = submesh->index_count;
+    submesh->lods[0].error = 0.0f;
+    submesh->lod_count = 1;
+    submesh->current_lod = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+      submesh->bounds_min[axis] = mesh->mNumVertices ? INFINITY : 0.0f;
+      submesh->bounds_max[axis] = mesh->mNumVertices ? -INFINITY : 0.0f;
+    }
+    for (unsigned int v = 0; v < mesh->mNumVertices; v++) {
+      for (int axis = 0; axis < 3; axis++) {
+        float value = vertices[v].position[axis];
+        if (value < submesh->bounds_min[axis])
+          submesh->bounds_min[axis] = value;
+        if (value > submesh->bounds_max[axis])
+          submesh->bounds_max[axis] = value;
+      }
+    }
+
+    base_vertex += mesh->mNumVertices;
+  }
+
+  scene_load_materials(scene, out);
+
+  free(refs);
+  aiReleaseImport(scene);
+
+  return 1;
+}
+
+// Draws every submesh, the texture is only rebound when the material changes.
+// The dequant uniforms map the 16-bit positions back into the submesh bounds.
+void draw_scene(
+    const struct imported_scene *scene,
+    GLuint fallback_texture,
+    GLint dequant_offset_location,
+    GLint dequant_scale_location
+) {
+  unsigned int material = (unsigned int) -1;
+  size_t index_size =
+      scene->index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t)
+                                             : sizeof(uint32_t);
+
+  unsigned int count = scene->visible_submeshes ? scene->visible_submesh_count
+                                                : scene->submesh_count;
+  for (unsigned int j = 0; j < count; j++) {
+    unsigned int i = scene->visible_submeshes ? scene->visible_submeshes[j] : j;
+    const struct scene_submesh *submesh = &scene->submeshes[i];
+
+    size_t vertex_end =
+        submesh->base_vertex + scene_submesh_vertex_count(scene, i);
+    if (vertex_end > scene->resident_vertices
+        || submesh->first_index + submesh->index_count
+               > scene->resident_indices)
+      continue;
+
+    // LODs past LOD 0 may still be on their way
+    unsigned int current_lod = submesh->current_lod;
+    while (current_lod > 0
+           && submesh->lods[current_lod].first_index
+                      + submesh->lods[current_lod].index_count
+                  > scene->resident_indices)
+      current_lod--;
+    const struct scene_lod *lod = &submesh->lods[current_lod];
+
+    // Everything at full detail was culled away
+    int culled = scene->meshlets.culling && current_lod == 0
+              && submesh->meshlet_count > 0;
+    if (culled && submesh->draw_count == 0)
+      continue;
+
+    if (submesh->material != material) {
+      material = submesh->material;
+
+      GLuint texture = fallback_texture;
+      if (material < scene->material_count
+          && scene->materials[material].texture)
+        texture = scene->materials[material].texture;
+
+      glBindTexture(GL_TEXTURE_2D, texture);
+    }
+
+    glUniform3fv(dequant_offset_location, 1, submesh->bounds_min);
+    glUniform3f(
+        dequant_scale_location,
+        submesh->bounds_max[0] - submesh->bounds_min[0],
+        submesh->bounds_max[1] - submesh->bounds_min[1],
+        submesh->bounds_max[2] - submesh->bounds_min[2]
+    );
+
+    if (culled) {
+      const struct scene_meshlets *meshlets = &scene->meshlets;
+      glMultiDrawElementsBaseVertex(
+          GL_TRIANGLES,
+          meshlets->draw_counts + submesh->first_draw,
+          scene->index_type,
+          meshlets->draw_offsets + submesh->first_draw,
+          (GLsizei) submesh->draw_count,
+          meshlets->draw_base_vertices + submesh->first_draw
+      );
+      continue;
+    }
+
+    glDrawElementsBaseVertex(
+        GL_TRIANGLES,
+        lod->index_count,
+        scene->index_type,
+        (GLvoid *) (lod->first_index * index_size),
+        submesh->base_vertex
+    );
+  }
+}
+
+// Releases the CPU side copies, the GL buffers are owned by the caller
+void free_scene_geometry(struct imported_scene *scene) {
+  if (scene->mapping) {
+    unmap_file(scene->mapping, scene->mapping_size);
+    scene->mapping = NULL;
+  } else {
+    free(scene->packed_vertices);
+    free(scene->packed_indices);
+  }
+
+  free(scene->vertices);
+  free(scene->indices);
+  scene->vertices = NULL;
+  scene->indices = NULL;
+  scene->packed_vertices = NULL;
+  scene->packed_indices = NULL;
+}
+
+void free_scene(struct imported_scene *scene) {
+  free_scene_geometry(scene);
+
+  for (unsigned int i = 0; i < scene->material_count; i++) {
+    if (scene->materials[i].texture)
+      glDeleteTextures(1, &scene->materials[i].texture);
+  }
+
+  free(scene->submeshes);
+  free(scene->materials);
+  free(scene->meshlets.storage);
+  memset(scene, 0, sizeof(*scene));
+}
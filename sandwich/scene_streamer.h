@@ -0,0 +1,349 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <glad/glad.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh_cache.h"
+#include "vertex_format.h"
+
+// Loads the model on a worker thread so the window shows up right away. The
+// worker posts the scene layout first and then the packed geometry in chunks,
+// submesh by submesh. The render thread uploads those chunks with a per frame
+// byte budget, and a submesh is drawn as soon as all of it is resident.
+
+#define STREAM_CHUNK_SIZE (256 * 1024)
+#define STREAM_UPLOAD_BUDGET (4 * 1024 * 1024) // bytes per frame
+
+enum stream_message_type {
+  STREAM_SCENE_READY, // layout is known, buffers can be allocated
+  STREAM_CHUNK,
+  STREAM_DONE,
+  STREAM_FAILED,
+};
+
+struct stream_message {
+  enum stream_message_type type;
+  GLenum target; // GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER
+  size_t offset, size;
+  const unsigned char *data;
+};
+
+enum stream_status {
+  STREAM_LOADING,
+  STREAM_COMPLETE,
+  STREAM_ERROR,
+};
+
+struct scene_streamer {
+  const char *source_path, *cache_path;
+
+  SDL_Thread *thread;
+  SDL_mutex *mutex;
+
+  // Message queue, the worker appends and the render thread pops
+  struct stream_message *messages;
+  size_t head, tail, capacity;
+
+  struct imported_scene loaded; // worker side copy of the scene
+  int scene_received;           // the render thread took over `loaded`
+  size_t front_uploaded;        // bytes of the front chunk already uploaded
+  uint64_t start_ticks;
+  enum stream_status status;
+};
+
+static void stream_post(
+    struct scene_streamer *streamer,
+    struct stream_message message
+) {
+  SDL_LockMutex(streamer->mutex);
+
+  if (streamer->tail == streamer->capacity) {
+    // Drop what was already consumed before growing
+    size_t pending = streamer->tail - streamer->head;
+    if (pending) {
+      memmove(
+          streamer->messages,
+          streamer->messages + streamer->head,
+          sizeof(struct stream_message) * pending
+      );
+    }
+    streamer->head = 0;
+    streamer->tail = pending;
+
+    if (streamer->tail == streamer->capacity) {
+      streamer->capacity = streamer->capacity ? streamer->capacity * 2 : 64;
+      streamer->messages = realloc(
+          streamer->messages,
+          sizeof(struct stream_message) * streamer->capacity
+      );
+    }
+  }
+
+  streamer->messages[streamer->tail++] = message;
+  SDL_UnlockMutex(streamer->mutex);
+}
+
+static void stream_post_range(
+    struct scene_streamer *streamer,
+    GLenum target,
+    const void *base,
+    size_t offset,
+    size_t size
+) {
+  while (size > 0) {
+    size_t chunk = size < STREAM_CHUNK_SIZE ? size : STREAM_CHUNK_SIZE;
+    struct stream_message message = {
+        STREAM_CHUNK,
+        target,
+        offset,
+        chunk,
+        (const unsigned char *) base + offset,
+    };
+    stream_post(streamer, message);
+
+    offset += chunk;
+    size -= chunk;
+  }
+}
+
+static int stream_worker(void *data) {
+  struct scene_streamer *streamer = data;
+  struct imported_scene *scene = &streamer->loaded;
+  struct stream_message message = {STREAM_FAILED, 0, 0, 0, NULL};
+
+  if (!load_scene(streamer->source_path, streamer->cache_path, scene)) {
+    stream_post(streamer, message);
+    return 0;
+  }
+
+  message.type = STREAM_SCENE_READY;
+  stream_post(streamer, message);
+
+  // Submesh by submesh, vertices first so the indices never point past them.
+  // LOD 0 ranges are stored back to back, the other LODs come after them.
+  size_t index_size = packed_index_size(scene);
+  size_t lod0_indices = 0;
+  for (unsigned int i = 0; i < scene->submesh_count; i++) {
+    const struct scene_submesh *submesh = &scene->submeshes[i];
+
+    stream_post_range(
+        streamer,
+        GL_ARRAY_BUFFER,
+        scene->packed_vertices,
+        submesh->base_vertex * sizeof(struct packed_vertex),
+        scene_submesh_vertex_count(scene, i) * sizeof(struct packed_vertex)
+    );
+    stream_post_range(
+        streamer,
+        GL_ELEMENT_ARRAY_BUFFER,
+        scene->packed_indices,
+        submesh->first_index * index_size,
+        submesh->index_count * index_size
+    );
+
+    lod0_indices = submesh->first_index + submesh->index_count;
+  }
+
+  stream_post_range(
+      streamer,
+      GL_ELEMENT_ARRAY_BUFFER,
+      scene->packed_indices,
+      lod0_indices * index_size,
+      (scene->index_count - lod0_indices) * index_size
+  );
+
+  message.type = STREAM_DONE;
+  stream_post(streamer, message);
+  return 0;
+}
+
+void start_scene_streamer(
+    struct scene_streamer *streamer,
+    const char *source_path,
+    const char *cache_path
+) {
+  memset(streamer, 0, sizeof(*streamer));
+  streamer->source_path = source_path;
+  streamer->cache_path = cache_path;
+  streamer->mutex = SDL_CreateMutex();
+  streamer->start_ticks = SDL_GetTicks64();
+  streamer->status = STREAM_LOADING;
+
+  streamer->thread =
+      SDL_CreateThread(stream_worker, "scene streamer", streamer);
+  if (!streamer->thread) {
+    printf("Couldn't start the model loader: %s\n", SDL_GetError());
+    streamer->status = STREAM_ERROR;
+  }
+}
+
+// The scene was laid out on the worker, give the render thread its own copy
+// and allocate the GPU buffers for everything that is about to arrive. The
+// scene's VAO is bound, the element buffer binding lives in it.
+static void stream_receive_scene(
+    struct scene_streamer *streamer,
+    struct imported_scene *scene,
+    GLuint vbo,
+    GLuint ebo
+) {
+  *scene = streamer->loaded;
+  streamer->scene_received = 1;
+  scene->resident_vertices = 0;
+  scene->resident_indices = 0;
+
+  printf(
+      "%u submeshes, %zu vertices, %zu indices%s\n",
+      scene->submesh_count,
+      scene->vertex_count,
+      scene->index_count,
+      scene->mapping ? " (cooked)" : ""
+  );
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(
+      GL_ARRAY_BUFFER,
+      sizeof(struct packed_vertex) * scene->vertex_count,
+      NULL,
+      GL_STATIC_DRAW
+  );
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  glBufferData(
+      GL_ELEMENT_ARRAY_BUFFER,
+      scene->index_count * packed_index_size(scene),
+      NULL,
+      GL_STATIC_DRAW
+  );
+
+  setup_packed_vertex_attributes();
+}
+
+// Uploads (part of) a chunk, returns how many bytes were uploaded
+static size_t stream_upload_chunk(
+    struct scene_streamer *streamer,
+    struct imported_scene *scene,
+    const struct stream_message *message,
+    size_t budget,
+    GLuint vbo,
+    GLuint ebo
+) {
+  size_t offset = message->offset + streamer->front_uploaded;
+  size_t size = message->size - streamer->front_uploaded;
+  if (size > budget)
+    size = budget;
+
+  glBindBuffer(
+      message->target,
+      message->target == GL_ARRAY_BUFFER ? vbo : ebo
+  );
+  glBufferSubData(
+      message->target,
+      offset,
+      size,
+      message->data + streamer->front_uploaded
+  );
+
+  // Chunks of one buffer arrive in order, so everything before the end of
+  // this one is resident now
+  if (message->target == GL_ARRAY_BUFFER)
+    scene->resident_vertices = (offset + size) / sizeof(struct packed_vertex);
+  else
+    scene->resident_indices = (offset + size) / packed_index_size(scene);
+
+  streamer->front_uploaded += size;
+  return size;
+}
+
+// Call once per frame on the render thread, the VAO, VBO and EBO are the ones
+// the scene gets drawn from
+enum stream_status update_scene_streamer(
+    struct scene_streamer *streamer,
+    struct imported_scene *scene,
+    GLuint vao,
+    GLuint vbo,
+    GLuint ebo
+) {
+  size_t budget = STREAM_UPLOAD_BUDGET;
+  glBindVertexArray(vao);
+
+  while (streamer->status == STREAM_LOADING && budget > 0) {
+    SDL_LockMutex(streamer->mutex);
+    int empty = streamer->head == streamer->tail;
+    struct stream_message message;
+    if (!empty)
+      message = streamer->messages[streamer->head];
+    SDL_UnlockMutex(streamer->mutex);
+
+    if (empty)
+      break;
+
+    int consumed = 1;
+    switch (message.type) {
+      case STREAM_SCENE_READY: {
+        stream_receive_scene(streamer, scene, vbo, ebo);
+      } break;
+
+      case STREAM_CHUNK: {
+        budget -= stream_upload_chunk(
+            streamer,
+            scene,
+            &message,
+            budget,
+            vbo,
+            ebo
+        );
+        consumed = streamer->front_uploaded == message.size;
+      } break;
+
+      case STREAM_DONE: {
+        SDL_WaitThread(streamer->thread, NULL);
+        streamer->thread = NULL;
+        free_scene_geometry(scene);
+        memset(&streamer->loaded, 0, sizeof(streamer->loaded));
+
+        printf(
+            "Model streamed in %llu ms\n",
+            (unsigned long long) (SDL_GetTicks64() - streamer->start_ticks)
+        );
+        streamer->status = STREAM_COMPLETE;
+      } break;
+
+      case STREAM_FAILED: {
+        SDL_WaitThread(streamer->thread, NULL);
+        streamer->thread = NULL;
+        streamer->status = STREAM_ERROR;
+      } break;
+    }
+
+    if (consumed) {
+      streamer->front_uploaded = 0;
+      SDL_LockMutex(streamer->mutex);
+      streamer->head++;
+      SDL_UnlockMutex(streamer->mutex);
+    }
+  }
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return streamer->status;
+}
+
+// Waits for the worker if it is still loading and drops everything it made
+void stop_scene_streamer(struct scene_streamer *streamer) {
+  if (streamer->thread) {
+    SDL_WaitThread(streamer->thread, NULL);
+    streamer->thread = NULL;
+
+    // The scene never reached the render thread, free it here
+    if (!streamer->scene_received)
+      free_scene(&streamer->loaded);
+  }
+
+  free(streamer->messages);
+  SDL_DestroyMutex(streamer->mutex);
+  memset(streamer, 0, sizeof(*streamer));
+}
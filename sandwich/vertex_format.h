@@ -0,0 +1,163 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scene_import.h"
+
+// Compact vertex layout, 16 bytes instead of the 32 of struct mesh_vertex:
+//   position  - unorm16 x3 relative to the submesh bounds (+ 2 bytes padding)
+//   normal    - GL_INT_2_10_10_10_REV, snorm
+//   tex_coord - half float x2, texture coordinates may leave [0, 1]
+// The vertex shader undoes the position quantization with the dequant_offset
+// and dequant_scale uniforms set per submesh.
+struct packed_vertex {
+  uint16_t position[4];
+  uint32_t normal;
+  uint16_t tex_coord[2];
+};
+
+static uint16_t pack_unorm16(float value) {
+  if (!(value > 0.0f)) // also catches NaN from a zero sized axis
+    return 0;
+  if (value >= 1.0f)
+    return 65535;
+  return (uint16_t) (value * 65535.0f + 0.5f);
+}
+
+static uint32_t pack_snorm10(float value) {
+  if (value > 1.0f)
+    value = 1.0f;
+  if (value < -1.0f)
+    value = -1.0f;
+  int32_t packed = (int32_t) lroundf(value * 511.0f);
+  return (uint32_t) packed & 0x3ff;
+}
+
+uint32_t pack_normal(const float *normal) {
+  return pack_snorm10(normal[0]) | pack_snorm10(normal[1]) << 10
+       | pack_snorm10(normal[2]) << 20;
+}
+
+// IEEE 754 binary16, rounds to nearest and flushes denormals to zero
+uint16_t float_to_half(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  uint32_t sign = (bits >> 16) & 0x8000;
+  int32_t exponent = (int32_t) ((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if (((bits >> 23) & 0xff) == 0xff) // inf & NaN
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  if (exponent <= 0)
+    return sign;
+  if (exponent >= 31)
+    return sign | 0x7c00;
+
+  uint32_t half = sign | (uint32_t) exponent << 10 | mantissa >> 13;
+  // Round to nearest, a carry into the exponent is still correct
+  if (mantissa & 0x1000)
+    half++;
+  return (uint16_t) half;
+}
+
+// Builds the packed vertices & indices from the imported ones. 16-bit indices
+// are used when every submesh has less than 65536 vertices, indices are local
+// to their submesh thanks to the base vertex.
+void pack_scene(struct imported_scene *scene) {
+  struct packed_vertex *packed =
+      malloc(sizeof(struct packed_vertex) * (scene->vertex_count + 1));
+
+  int small_indices = 1;
+  for (unsigned int i = 0; i < scene->submesh_count; i++) {
+    const struct scene_submesh *submesh = &scene->submeshes[i];
+    size_t vertex_count = scene_submesh_vertex_count(scene, i);
+
+    if (vertex_count >= 65536)
+      small_indices = 0;
+
+    float scale[3];
+    for (int axis = 0; axis < 3; axis++) {
+      float extent = submesh->bounds_max[axis] - submesh->bounds_min[axis];
+      scale[axis] = extent > 0.0f ? 1.0f / extent : 0.0f;
+    }
+
+    size_t end = submesh->base_vertex + vertex_count;
+    for (size_t v = submesh->base_vertex; v < end; v++) {
+      const struct mesh_vertex *vertex = &scene->vertices[v];
+
+      for (int axis = 0; axis < 3; axis++) {
+        packed[v].position[axis] = pack_unorm16(
+            (vertex->position[axis] - submesh->bounds_min[axis]) * scale[axis]
+        );
+      }
+      packed[v].position[3] = 0;
+      packed[v].normal = pack_normal(vertex->normal);
+      packed[v].tex_coord[0] = float_to_half(vertex->tex_coord[0]);
+      packed[v].tex_coord[1] = float_to_half(vertex->tex_coord[1]);
+    }
+  }
+
+  scene->packed_vertices = packed;
+
+  if (small_indices) {
+    uint16_t *indices = malloc(sizeof(uint16_t) * (scene->index_count + 1));
+    for (size_t i = 0; i < scene->index_count; i++)
+      indices[i] = (uint16_t) scene->indices[i];
+
+    scene->packed_indices = indices;
+    scene->index_type = GL_UNSIGNED_SHORT;
+  } else {
+    uint32_t *indices = malloc(sizeof(uint32_t) * (scene->index_count + 1));
+    memcpy(indices, scene->indices, sizeof(uint32_t) * scene->index_count);
+
+    scene->packed_indices = indices;
+    scene->index_type = GL_UNSIGNED_INT;
+  }
+}
+
+size_t packed_index_size(const struct imported_scene *scene) {
+  return scene->index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t)
+                                                : sizeof(uint32_t);
+}
+
+// Attribute setup for the currently bound VAO & VBO
+void setup_packed_vertex_attributes(void) {
+  // Position attribute
+  glVertexAttribPointer(
+      0,
+      3,
+      GL_UNSIGNED_SHORT,
+      GL_TRUE,
+      sizeof(struct packed_vertex),
+      (GLvoid *) offsetof(struct packed_vertex, position)
+  );
+  glEnableVertexAttribArray(0);
+
+  // Normal attribute
+  glVertexAttribPointer(
+      1,
+      4,
+      GL_INT_2_10_10_10_REV,
+      GL_TRUE,
+      sizeof(struct packed_vertex),
+      (GLvoid *) offsetof(struct packed_vertex, normal)
+  );
+  glEnableVertexAttribArray(1);
+
+  // Texture Coord attribute
+  glVertexAttribPointer(
+      2,
+      2,
+      GL_HALF_FLOAT,
+      GL_FALSE,
+      sizeof(struct packed_vertex),
+      (GLvoid *) offsetof(struct packed_vertex, tex_coord)
+  );
+  glEnableVertexAttribArray(2);
+}
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "instancing.h"
+
+// Three ways to feed the cube to the vertex shader:
+//   unindexed - 36 positions & 36 colours in two buffers, the original
+//   aos       - 8 shared corners, position & colour interleaved, 36 indices
+//   soa       - 8 shared corners, positions & colours in separate buffers
+// The indexed layouts give every corner one colour, the unindexed cube keeps
+// the colour per triangle corner.
+
+enum cube_layout {
+  CUBE_UNINDEXED,
+  CUBE_INDEXED_AOS,
+  CUBE_INDEXED_SOA,
+  CUBE_LAYOUT_COUNT,
+};
+
+static const char *const cube_layout_names[CUBE_LAYOUT_COUNT] = {
+    "unindexed",
+    "aos",
+    "soa",
+};
+
+const GLfloat cube_vertices[] = { // Positions
+    -0.5f, -0.5f, -0.5f,
+
+    0.5f,  -0.5f, -0.5f,
+
+    0.5f,  0.5f,  -0.5f,
+
+    0.5f,  0.5f,  -0.5f,
+
+    -0.5f, 0.5f,  -0.5f,
+
+    -0.5f, -0.5f, -0.5f,
+
+    -0.5f, -0.5f, 0.5f,
+
+    0.5f,  -0.5f, 0.5f,
+
+    0.5f,  0.5f,  0.5f,
+
+    0.5f,  0.5f,  0.5f,
+
+    -0.5f, 0.5f,  0.5f,
+
+    -0.5f, -0.5f, 0.5f,
+
+    -0.5f, 0.5f,  0.5f,
+
+    -0.5f, 0.5f,  -0.5f,
+
+    -0.5f, -0.5f, -0.5f,
+
+    -0.5f, -0.5f, -0.5f,
+
+    -0.5f, -0.5f, 0.5f,
+
+    -0.5f, 0.5f,  0.5f,
+
+    0.5f,  0.5f,  0.5f,
+
+    0.5f,  0.5f,  -0.5f,
+
+    0.5f,  -0.5f, -0.5f,
+
+    0.5f,  -0.5f, -0.5f,
+
+    0.5f,  -0.5f, 0.5f,
+
+    0.5f,  0.5f,  0.5f,
+
+    -0.5f, -0.5f, -0.5f,
+
+    0.5f,  -0.5f, -0.5f,
+
+    0.5f,  -0.5f, 0.5f,
+
+    0.5f,  -0.5f, 0.5f,
+
+    -0.5f, -0.5f, 0.5f,
+
+    -0.5f, -0.5f, -0.5f,
+
+    -0.5f, 0.5f,  -0.5f,
+
+    0.5f,  0.5f,  -0.5f,
+
+    0.5f,  0.5f,  0.5f,
+
+    0.5f,  0.5f,  0.5f,
+
+    -0.5f, 0.5f,  0.5f,
+
+    -0.5f, 0.5f,  -0.5f
+};
+
+const GLfloat colors[] = {
+    0.583f, 0.771f, 0.014f, 0.609f, 0.115f, 0.436f, 0.327f, 0.483f, 0.844f,
+    0.822f, 0.569f, 0.201f, 0.435f, 0.602f, 0.223f, 0.310f, 0.747f, 0.185f,
+    0.597f, 0.770f, 0.761f, 0.559f, 0.436f, 0.730f, 0.359f, 0.583f, 0.152f,
+    0.483f, 0.596f, 0.789f, 0.559f, 0.861f, 0.639f, 0.195f, 0.548f, 0.859f,
+    0.014f, 0.184f, 0.576f, 0.771f, 0.328f, 0.970f, 0.406f, 0.615f, 0.116f,
+    0.676f, 0.977f, 0.133f, 0.971f, 0.572f, 0.833f, 0.140f, 0.616f, 0.489f,
+    0.997f, 0.513f, 0.064f, 0.945f, 0.719f, 0.592f, 0.543f, 0.021f, 0.978f,
+    0.279f, 0.317f, 0.505f, 0.167f, 0.620f, 0.077f, 0.347f, 0.857f, 0.137f,
+    0.055f, 0.953f, 0.042f, 0.714f, 0.505f, 0.345f, 0.783f, 0.290f, 0.734f,
+    0.722f, 0.645f, 0.174f, 0.302f, 0.455f, 0.848f, 0.225f, 0.587f, 0.040f,
+    0.517f, 0.713f, 0.338f, 0.053f, 0.959f, 0.120f, 0.393f, 0.621f, 0.362f,
+    0.673f, 0.211f, 0.457f, 0.820f, 0.883f, 0.371f, 0.982f, 0.099f, 0.879f
+};
+
+// Corner i sits at x = i & 1, y = i >> 1 & 1, z = i >> 2 (minus 0.5)
+const GLfloat cube_corner_positions[] = {
+    -0.5f, -0.5f, -0.5f, // 0
+    0.5f,  -0.5f, -0.5f, // 1
+    -0.5f, 0.5f,  -0.5f, // 2
+    0.5f,  0.5f,  -0.5f, // 3
+    -0.5f, -0.5f, 0.5f,  // 4
+    0.5f,  -0.5f, 0.5f,  // 5
+    -0.5f, 0.5f,  0.5f,  // 6
+    0.5f,  0.5f,  0.5f,  // 7
+};
+
+// The first 8 colours of the unindexed cube, one per corner
+#define CUBE_CORNER_COLORS_SIZE (sizeof(GLfloat) * 3 * 8)
+
+// Counter clockwise seen from outside
+const GLubyte cube_indices[] = {
+    0, 2, 1, 1, 2, 3, // -z
+    4, 5, 6, 5, 7, 6, // +z
+    0, 4, 2, 2, 4, 6, // -x
+    1, 3, 5, 3, 7, 5, // +x
+    0, 1, 4, 1, 5, 4, // -y
+    2, 6, 3, 3, 6, 7, // +y
+};
+
+struct cube_vertex {
+  GLfloat position[3];
+  GLfloat color[3];
+};
+
+struct cube_geometry {
+  enum cube_layout layout;
+  GLuint vao;
+  GLuint buffers[3]; // vertex buffer(s), then the index buffer if any
+  size_t size;       // bytes of vertex & index data
+  size_t matrix_offset; // where the instance attributes point
+};
+
+// Looks a layout up by name, returns CUBE_LAYOUT_COUNT for unknown names
+enum cube_layout find_cube_layout(const char *name) {
+  for (int i = 0; i < CUBE_LAYOUT_COUNT; i++) {
+    if (strcmp(name, cube_layout_names[i]) == 0)
+      return (enum cube_layout) i;
+  }
+  return CUBE_LAYOUT_COUNT;
+}
+
+static void cube_vertex_attribute(
+    GLuint location,
+    GLuint buffer,
+    GLsizei stride,
+    size_t offset
+) {
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glVertexAttribPointer(
+      location,
+      3,
+      GL_FLOAT,
+      GL_FALSE,
+      stride,
+      (GLvoid *) offset
+  );
+  glEnableVertexAttribArray(location);
+}
+
+// Creates a VAO for the layout, with the instance attributes attached
+void init_cube_geometry(
+    struct cube_geometry *geometry,
+    enum cube_layout layout,
+    const struct cube_instances *instances
+) {
+  memset(geometry, 0, sizeof(*geometry));
+  geometry->layout = layout;
+
+  glGenVertexArrays(1, &geometry->vao);
+  glBindVertexArray(geometry->vao);
+  glGenBuffers(3, geometry->buffers);
+
+  switch (layout) {
+    case CUBE_UNINDEXED: {
+      glBindBuffer(GL_ARRAY_BUFFER, geometry->buffers[0]);
+      glBufferData(
+          GL_ARRAY_BUFFER,
+          sizeof(cube_vertices),
+          cube_vertices,
+          GL_STATIC_DRAW
+      );
+      glBindBuffer(GL_ARRAY_BUFFER, geometry->buffers[1]);
+      glBufferData(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
+
+      cube_vertex_attribute(0, geometry->buffers[0], 0, 0);
+      cube_vertex_attribute(1, geometry->buffers[1], 0, 0);
+      geometry->size = sizeof(cube_vertices) + sizeof(colors);
+    } break;
+
+    case CUBE_INDEXED_AOS: {
+      struct cube_vertex vertices[8];
+      for (int i = 0; i < 8; i++) {
+        memcpy(
+            vertices[i].position,
+            cube_corner_positions + i * 3,
+            sizeof(vertices[i].position)
+        );
+        memcpy(vertices[i].color, colors + i * 3, sizeof(vertices[i].color));
+      }
+
+      glBindBuffer(GL_ARRAY_BUFFER, geometry->buffers[0]);
+      glBufferData(
+          GL_ARRAY_BUFFER,
+          sizeof(vertices),
+          vertices,
+          GL_STATIC_DRAW
+      );
+
+      cube_vertex_attribute(
+          0,
+          geometry->buffers[0],
+          sizeof(struct cube_vertex),
+          offsetof(struct cube_vertex, position)
+      );
+      cube_vertex_attribute(
+          1,
+          geometry->buffers[0],
+          sizeof(struct cube_vertex),
+          offsetof(struct cube_vertex, color)
+      );
+      geometry->size = sizeof(vertices) + sizeof(cube_indices);
+    } break;
+
+    case CUBE_INDEXED_SOA:
+    default: {
+      glBindBuffer(GL_ARRAY_BUFFER, geometry->buffers[0]);
+      glBufferData(
+          GL_ARRAY_BUFFER,
+          sizeof(cube_corner_positions),
+          cube_corner_positions,
+          GL_STATIC_DRAW
+      );
+      glBindBuffer(GL_ARRAY_BUFFER, geometry->buffers[1]);
+      glBufferData(
+          GL_ARRAY_BUFFER,
+          CUBE_CORNER_COLORS_SIZE,
+          colors,
+          GL_STATIC_DRAW
+      );
+
+      cube_vertex_attribute(0, geometry->buffers[0], 0, 0);
+      cube_vertex_attribute(1, geometry->buffers[1], 0, 0);
+      geometry->size = sizeof(cube_corner_positions) + CUBE_CORNER_COLORS_SIZE
+                     + sizeof(cube_indices);
+    } break;
+  }
+
+  if (layout != CUBE_UNINDEXED) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry->buffers[2]);
+    glBufferData(
+        GL_ELEMENT_ARRAY_BUFFER,
+        sizeof(cube_indices),
+        cube_indices,
+        GL_STATIC_DRAW
+    );
+  }
+
+  bind_cube_instance_attributes(instances);
+  geometry->matrix_offset = instances->matrix_stream.offset;
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void draw_cube_geometry(
+    struct cube_geometry *geometry,
+    const struct cube_instances *instances
+) {
+  glBindVertexArray(geometry->vao);
+
+  // The records move to another part of the stream buffer every frame
+  if (geometry->matrix_offset != instances->matrix_stream.offset) {
+    bind_cube_instance_attributes(instances);
+    geometry->matrix_offset = instances->matrix_stream.offset;
+  }
+
+  // Only the instances inside the frustum were uploaded
+  if (geometry->layout == CUBE_UNINDEXED)
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, instances->visible_count);
+  else
+    glDrawElementsInstanced(
+        GL_TRIANGLES,
+        36,
+        GL_UNSIGNED_BYTE,
+        (GLvoid *) 0,
+        instances->visible_count
+    );
+  glBindVertexArray(0);
+}
+
+void free_cube_geometry(struct cube_geometry *geometry) {
+  glDeleteVertexArrays(1, &geometry->vao);
+  glDeleteBuffers(3, geometry->buffers);
+  memset(geometry, 0, sizeof(*geometry));
+}
+
+#define CUBE_BENCH_WARMUP_FRAMES 10
+#define CUBE_BENCH_FRAMES 100
+
+// Draws the instances with every layout for a while and prints how long the
+// GPU took, the program and its uniforms have to be set up already
+void benchmark_cube_layouts(
+    SDL_Window *window,
+    const struct cube_instances *instances
+) {
+  GLuint query;
+  glGenQueries(1, &query);
+
+  printf(
+      "%d cubes (%d visible), %d frames per layout\n",
+      instances->count,
+      instances->visible_count,
+      CUBE_BENCH_FRAMES
+  );
+
+  for (int layout = 0; layout < CUBE_LAYOUT_COUNT; layout++) {
+    struct cube_geometry geometry;
+    init_cube_geometry(&geometry, (enum cube_layout) layout, instances);
+
+    GLuint64 total = 0;
+    for (int frame = 0; frame < CUBE_BENCH_WARMUP_FRAMES + CUBE_BENCH_FRAMES;
+         frame++) {
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+      glBeginQuery(GL_TIME_ELAPSED, query);
+      draw_cube_geometry(&geometry, instances);
+      glEndQuery(GL_TIME_ELAPSED);
+
+      SDL_GL_SwapWindow(window);
+
+      GLuint64 elapsed;
+      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+      if (frame >= CUBE_BENCH_WARMUP_FRAMES)
+        total += elapsed;
+    }
+
+    double ms = (double) total / CUBE_BENCH_FRAMES / 1e6;
+    double vertices = 36.0 * instances->visible_count;
+    printf(
+        "%-9s %4zu bytes  %7.3f ms  %8.1f M vertices/s\n",
+        cube_layout_names[layout],
+        geometry.size,
+        ms,
+        ms > 0.0 ? vertices / ms / 1e3 : 0.0
+    );
+
+    free_cube_geometry(&geometry);
+  }
+
+  glDeleteQueries(1, &query);
+}
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <glad/glad.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/frustum.h"
+#include "../common/transform.h"
+#include "stream_buffer.h"
+
+// Draws many copies of the cube with one glDrawArraysInstanced. Every
+// instance has its own transform (attributes 2-5, a mat4 takes four slots)
+// and a colour (attribute 6) that tints the vertex colours. The instances are
+// nodes of the scene's transform graph, children of one grid node. Every
+// frame the cubes outside the view frustum are culled and the world matrices
+// and colours of the rest are copied into a stream buffer, which is the
+// point of the stress test. A single instance sits at the origin untinted,
+// exactly like the plain cube.
+
+#define INSTANCE_MATRIX_LOCATION 2
+#define INSTANCE_COLOR_LOCATION 6
+#define INSTANCE_GRID_SIZE 3.0f // the whole grid fits in this cube
+
+struct cube_instances {
+  int count;
+  int side; // cubes per grid row
+
+  // Nodes in the transform graph, the instances are consecutive so their
+  // world matrices are too
+  uint32_t grid_node, first_node;
+
+  float *colors; // count rgb triples
+
+  // Bounding spheres in grid space as x, y, z & radius arrays of count
+  // floats. The cubes only spin in place, so these never change.
+  float *bounds;
+
+  // Instances that survived the last cull_cube_instances
+  uint32_t *visible;
+  int visible_count;
+
+  // visible_count instance records per frame
+  struct stream_buffer matrix_stream;
+
+  // Stats for the stress test
+  uint32_t stats_start;
+  int stats_frames;
+};
+
+static void instance_color(int index, int count, float *color) {
+  if (count == 1) {
+    color[0] = color[1] = color[2] = 1.0f;
+    return;
+  }
+
+  // Cheap hash, it just needs to look random
+  uint32_t hash = (uint32_t) index * 2654435761u;
+  for (int k = 0; k < 3; k++) {
+    color[k] = 0.4f + 0.6f * (float) ((hash >> (k * 8)) & 0xff) / 255.0f;
+  }
+}
+
+// What the vertex shader gets per instance
+struct instance_record {
+  float model[16]; // column major
+  float color[4];  // rgb, the last one is padding
+};
+
+// Lays the cubes out in a grid that fits in INSTANCE_GRID_SIZE
+void init_cube_instances(
+    struct cube_instances *instances,
+    int count,
+    enum stream_strategy strategy,
+    struct transform_graph *graph
+) {
+  memset(instances, 0, sizeof(*instances));
+  instances->count = count;
+  instances->side = (int) ceilf(cbrtf((float) count));
+  while (instances->side * instances->side * instances->side < count)
+    instances->side++;
+
+  instances->colors = malloc(sizeof(float) * 3 * count);
+  instances->bounds = malloc(sizeof(float) * 4 * count);
+  instances->visible = malloc(sizeof(uint32_t) * count);
+  for (int i = 0; i < count; i++)
+    instance_color(i, count, instances->colors + i * 3);
+
+  int side = instances->side;
+  float spacing = INSTANCE_GRID_SIZE / side;
+  float scale = spacing * 0.5f < 1.0f ? spacing * 0.5f : 1.0f;
+  float center = (side - 1) * 0.5f;
+
+  // The corners of a unit cube are sqrt(3) / 2 away from its center
+  float radius = scale * 0.8660254f;
+  float *bounds_x = instances->bounds, *bounds_y = bounds_x + count,
+        *bounds_z = bounds_y + count, *bounds_radius = bounds_z + count;
+
+  instances->grid_node = add_transform_node(graph, TRANSFORM_NO_PARENT);
+  for (int i = 0; i < count; i++) {
+    uint32_t node = add_transform_node(graph, instances->grid_node);
+    if (i == 0)
+      instances->first_node = node;
+
+    int x = i % side, y = (i / side) % side, z = i / (side * side);
+    bounds_x[i] = (x - center) * spacing;
+    bounds_y[i] = (y - center) * spacing;
+    bounds_z[i] = (z - center) * spacing;
+    bounds_radius[i] = radius;
+
+    set_transform_translation(
+        graph,
+        node,
+        bounds_x[i],
+        bounds_y[i],
+        bounds_z[i]
+    );
+    set_transform_scale(graph, node, scale, scale, scale);
+  }
+
+  init_stream_buffer(
+      &instances->matrix_stream,
+      GL_ARRAY_BUFFER,
+      sizeof(struct instance_record) * count,
+      strategy
+  );
+
+  instances->stats_start = SDL_GetTicks();
+}
+
+// Points the instance attributes of the bound VAO at this frame's records
+void bind_cube_instance_attributes(const struct cube_instances *instances) {
+  size_t offset = instances->matrix_stream.offset;
+
+  glBindBuffer(GL_ARRAY_BUFFER, instances->matrix_stream.buffer);
+  for (int column = 0; column < 4; column++) {
+    GLuint location = INSTANCE_MATRIX_LOCATION + column;
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(
+        location,
+        4,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(struct instance_record),
+        (GLvoid *) (offset + sizeof(float) * 4 * column)
+    );
+    glVertexAttribDivisor(location, 1);
+  }
+
+  glEnableVertexAttribArray(INSTANCE_COLOR_LOCATION);
+  glVertexAttribPointer(
+      INSTANCE_COLOR_LOCATION,
+      3,
+      GL_FLOAT,
+      GL_FALSE,
+      sizeof(struct instance_record),
+      (GLvoid *) (offset + offsetof(struct instance_record, color))
+  );
+  glVertexAttribDivisor(INSTANCE_COLOR_LOCATION, 1);
+}
+
+// Spins every cube around its own Y axis at its own speed. Every seventh one
+// stands still (so does a single cube, the model matrix turns it), those
+// stay clean in the transform graph.
+void update_cube_instances(
+    struct cube_instances *instances,
+    struct transform_graph *graph,
+    float angle
+) {
+  for (int i = 0; i < instances->count; i++) {
+    if (i % 7 == 0)
+      continue;
+
+    float rotation[4];
+    quat_from_axis_angle(
+        rotation,
+        angle * (float) (i % 7) * 0.25f,
+        0.0f,
+        1.0f,
+        0.0f
+    );
+    set_transform_rotation(graph, instances->first_node + i, rotation);
+  }
+}
+
+// Tests the bounding spheres against the frustum, `model` is the world
+// matrix of the grid's parent
+void cull_cube_instances(
+    struct cube_instances *instances,
+    const float *model,
+    const float *view,
+    const float *projection
+) {
+  // The grid node has no transform of its own, so model space planes work
+  // on the grid space bounds directly
+  struct frustum frustum;
+  frustum_from_matrices(&frustum, model, view, projection);
+
+  int count = instances->count;
+  const float *bounds = instances->bounds;
+  instances->visible_count = (int) frustum_cull_spheres(
+      &frustum,
+      bounds,
+      bounds + count,
+      bounds + count * 2,
+      bounds + count * 3,
+      (size_t) count,
+      instances->visible
+  );
+}
+
+// Copies the world matrices and colours of the visible instances into this
+// frame's part of the stream buffer, call after update_transform_graph
+void upload_cube_instances(
+    struct cube_instances *instances,
+    const struct transform_graph *graph
+) {
+  // A frame with nothing visible still maps (and later fences) its region,
+  // which keeps the ring in step
+  int count = instances->visible_count ? instances->visible_count : 1;
+  size_t size = sizeof(struct instance_record) * count;
+  struct instance_record *records =
+      map_stream_buffer(&instances->matrix_stream, size);
+  if (!records)
+    return;
+
+  // Written front to back into the mapping, never read back
+  const float *worlds = transform_world(graph, instances->first_node);
+  for (int i = 0; i < instances->visible_count; i++) {
+    uint32_t index = instances->visible[i];
+    struct instance_record record;
+    memcpy(record.model, worlds + index * 16, sizeof(record.model));
+    memcpy(record.color, instances->colors + index * 3, sizeof(float) * 3);
+    record.color[3] = 1.0f;
+    records[i] = record;
+  }
+  unmap_stream_buffer(&instances->matrix_stream);
+}
+
+// Prints the average frame time every couple of seconds when stress testing
+void report_cube_instances(struct cube_instances *instances) {
+  if (instances->count == 1)
+    return;
+
+  instances->stats_frames++;
+  uint32_t elapsed = SDL_GetTicks() - instances->stats_start;
+  if (elapsed < 2000)
+    return;
+
+  struct stream_buffer *stream = &instances->matrix_stream;
+  printf(
+      "%d instances (%d visible, %d culled): %.2f ms per frame, "
+      "%u upload stalls (%.2f ms)\n",
+      instances->count,
+      instances->visible_count,
+      instances->count - instances->visible_count,
+      (double) elapsed / instances->stats_frames,
+      stream->stalls,
+      (double) stream->stall_ticks * 1000.0
+          / (double) SDL_GetPerformanceFrequency()
+  );
+  instances->stats_start = SDL_GetTicks();
+  instances->stats_frames = 0;
+  stream->stalls = 0;
+  stream->stall_ticks = 0;
+}
+
+void free_cube_instances(struct cube_instances *instances) {
+  free_stream_buffer(&instances->matrix_stream);
+  free(instances->colors);
+  free(instances->bounds);
+  free(instances->visible);
+  memset(instances, 0, sizeof(*instances));
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../common/job_pool.h"
+#include "../common/mat4.h"
+#include "../common/transform.h"
+
+// `--bench-math`: times common/mat4.h against the scalar matrix code the 3D
+// examples used before it, then updates of a big transform graph. The
+// reference functions below are kept exactly as they were, including their
+// row by column indexing, which makes reference_multiply_matrices(r, a, b)
+// the same thing as mat4_multiply(r, b, a).
+
+#define MATH_BENCH_MATRICES 4096
+#define MATH_BENCH_ROUNDS 256
+#define MATH_BENCH_NODES 50000
+
+void reference_multiply_matrices(
+    float *result,
+    const float *mat1,
+    const float *mat2
+) {
+  for (int row = 0; row < 4; ++row) {
+    for (int col = 0; col < 4; ++col) {
+      result[row * 4 + col] = 0;
+      for (int k = 0; k < 4; ++k) {
+        result[row * 4 + col] += mat1[row * 4 + k] * mat2[k * 4 + col];
+      }
+    }
+  }
+}
+
+void reference_rotate_matrix(
+    float *matrix,
+    float angle,
+    float x,
+    float y,
+    float z
+) {
+  float c = cos(angle);
+  float s = sin(angle);
+  float axis_length = sqrt(x * x + y * y + z * z);
+  x /= axis_length;
+  y /= axis_length;
+  z /= axis_length;
+
+  float rotation[16] = {
+      c + (1 - c) * x * x,
+      (1 - c) * x * y - s * z,
+      (1 - c) * x * z + s * y,
+      0.0f,
+      (1 - c) * y * x + s * z,
+      c + (1 - c) * y * y,
+      (1 - c) * y * z - s * x,
+      0.0f,
+      (1 - c) * z * x - s * y,
+      (1 - c) * z * y + s * x,
+      c + (1 - c) * z * z,
+      0.0f,
+      0.0f,
+      0.0f,
+      0.0f,
+      1.0f
+  };
+
+  float result[16];
+  reference_multiply_matrices(result, matrix, rotation);
+  for (int i = 0; i < 16; i++)
+    matrix[i] = result[i];
+}
+
+// Point transform the way the LOD selection used to do it
+static void reference_transform_point(
+    float *result,
+    const float *matrix,
+    const float *point
+) {
+  for (int row = 0; row < 4; row++) {
+    result[row] = matrix[row] * point[0] + matrix[4 + row] * point[1]
+                + matrix[8 + row] * point[2] + matrix[12 + row];
+  }
+}
+
+static double math_bench_seconds(uint64_t start) {
+  return (double) (SDL_GetPerformanceCounter() - start)
+       / (double) SDL_GetPerformanceFrequency();
+}
+
+static void math_bench_report(
+    const char *name,
+    double reference,
+    double simd,
+    size_t operations,
+    float max_difference
+) {
+  printf(
+      "%-18s %7.2f ns -> %6.2f ns  %5.2fx  (max difference %g)\n",
+      name,
+      reference * 1e9 / (double) operations,
+      simd * 1e9 / (double) operations,
+      simd > 0.0 ? reference / simd : 0.0,
+      (double) max_difference
+  );
+}
+
+static float math_bench_difference(const float *a, const float *b, size_t n) {
+  float max = 0.0f;
+  for (size_t i = 0; i < n; i++) {
+    float d = fabsf(a[i] - b[i]);
+    if (d > max)
+      max = d;
+  }
+  return max;
+}
+
+void benchmark_math(void) {
+  size_t count = MATH_BENCH_MATRICES;
+  size_t operations = count * MATH_BENCH_ROUNDS;
+  float *matrices = malloc(sizeof(float) * 16 * count);
+  float *expected = malloc(sizeof(float) * 16 * count);
+  float *results = malloc(sizeof(float) * 16 * count);
+  float *points = malloc(sizeof(float) * 3 * count);
+
+  srand(1);
+  for (size_t i = 0; i < count * 16; i++)
+    matrices[i] = (float) rand() / (float) RAND_MAX * 2.0f - 1.0f;
+  for (size_t i = 0; i < count * 3; i++)
+    points[i] = (float) rand() / (float) RAND_MAX * 2.0f - 1.0f;
+
+  const float *view = matrices;
+  float checksum = 0.0f;
+
+  printf(
+      "%zu matrices x %d rounds, time per operation\n",
+      count,
+      MATH_BENCH_ROUNDS
+  );
+
+  // One multiply per matrix
+  uint64_t start = SDL_GetPerformanceCounter();
+  for (int round = 0; round < MATH_BENCH_ROUNDS; round++) {
+    for (size_t i = 0; i < count; i++)
+      reference_multiply_matrices(expected + i * 16, matrices + i * 16, view);
+    checksum += expected[round % (count * 16)];
+  }
+  double reference = math_bench_seconds(start);
+
+  start = SDL_GetPerformanceCounter();
+  for (int round = 0; round < MATH_BENCH_ROUNDS; round++) {
+    for (size_t i = 0; i < count; i++)
+      mat4_multiply(results + i * 16, view, matrices + i * 16);
+    checksum += results[round % (count * 16)];
+  }
+  double simd = math_bench_seconds(start);
+  math_bench_report(
+      "multiply",
+      reference,
+      simd,
+      operations,
+      math_bench_difference(expected, results, count * 16)
+  );
+
+  // Same, with the left hand side loaded once for the whole batch
+  start = SDL_GetPerformanceCounter();
+  for (int round = 0; round < MATH_BENCH_ROUNDS; round++) {
+    mat4_multiply_batch(results, view, matrices, count);
+    checksum += results[round % (count * 16)];
+  }
+  simd = math_bench_seconds(start);
+  math_bench_report(
+      "multiply batch",
+      reference,
+      simd,
+      operations,
+      math_bench_difference(expected, results, count * 16)
+  );
+
+  // Spinning a model matrix the old way and with the Y axis shortcut, which
+  // turns the other way around for the same angle
+  for (size_t i = 0; i < count * 16; i++)
+    expected[i] = results[i] = matrices[i];
+
+  start = SDL_GetPerformanceCounter();
+  for (int round = 0; round < MATH_BENCH_ROUNDS; round++) {
+    for (size_t i = 0; i < count; i++)
+      reference_rotate_matrix(expected + i * 16, 0.001f, 0.0f, 1.0f, 0.0f);
+    checksum += expected[round % (count * 16)];
+  }
+  reference = math_bench_seconds(start);
+
+  start = SDL_GetPerformanceCounter();
+  for (int round = 0; round < MATH_BENCH_ROUNDS; round++) {
+    for (size_t i = 0; i < count; i++) {
+      // The reference multiplies by the rotation from the left
+      float *m = results + i * 16;
+      float rotation[16];
+      mat4_identity(rotation);
+      mat4_rotate_y(rotation, -0.001f);
+      mat4_multiply(m, rotation, m);
+    }
+    checksum += results[round % (count * 16)];
+  }
+  simd = math_bench_seconds(start);
+  math_bench_report(
+      "rotate",
+      reference,
+      simd,
+      operations,
+      math_bench_difference(expected, results, count * 16)
+  );
+
+  // Points, count of them per round
+  start = SDL_GetPerformanceCounter();
+  for (int round = 0; round < MATH_BENCH_ROUNDS; round++) {
+    for (size_t i = 0; i < count; i++)
+      reference_transform_point(expected + i * 4, view, points + i * 3);
+    checksum += expected[round % (count * 4)];
+  }
+  reference = math_bench_seconds(start);
+
+  start = SDL_GetPerformanceCounter();
+  for (int round = 0; round < MATH_BENCH_ROUNDS; round++) {
+    mat4_transform_points(results, view, points, count);
+    checksum += results[round % (count * 4)];
+  }
+  simd = math_bench_seconds(start);
+  math_bench_report(
+      "transform points",
+      reference,
+      simd,
+      operations,
+      math_bench_difference(expected, results, count * 4)
+  );
+
+  // A random tree, every node hangs off an earlier one
+  struct transform_graph graph;
+  init_transform_graph(&graph);
+  add_transform_node(&graph, TRANSFORM_NO_PARENT);
+  for (uint32_t i = 1; i < MATH_BENCH_NODES; i++) {
+    uint32_t node = add_transform_node(&graph, (uint32_t) rand() % i);
+    set_transform_translation(&graph, node, 0.1f, 0.0f, 0.0f);
+  }
+
+  struct job_pool pool;
+  init_job_pool(&pool, 0);
+
+  float rotation[4];
+  quat_from_axis_angle(rotation, 0.001f, 0.0f, 1.0f, 0.0f);
+
+  // Everything, then a node deep in the tree, then nothing at all
+  uint32_t dirty_nodes[] = {0, MATH_BENCH_NODES - 1, TRANSFORM_NO_PARENT};
+  const char *names[] = {"graph all dirty", "graph one leaf", "graph clean"};
+  for (int test = 0; test < 3; test++) {
+    double total = 0.0;
+    uint32_t updated = 0;
+    for (int round = 0; round < MATH_BENCH_ROUNDS; round++) {
+      if (dirty_nodes[test] != TRANSFORM_NO_PARENT)
+        set_transform_rotation(&graph, dirty_nodes[test], rotation);
+
+      start = SDL_GetPerformanceCounter();
+      update_transform_graph(&graph, &pool);
+      total += math_bench_seconds(start);
+      updated = graph.updated;
+    }
+
+    printf(
+        "%-18s %8.1f us for %u of %d nodes, %d threads\n",
+        names[test],
+        total * 1e6 / MATH_BENCH_ROUNDS,
+        updated,
+        MATH_BENCH_NODES,
+        pool.thread_count + 1
+    );
+  }
+  checksum += transform_world(&graph, MATH_BENCH_NODES - 1)[12];
+
+  destroy_job_pool(&pool);
+  free_transform_graph(&graph);
+
+  // Keeps the compiler from throwing the loops away
+  printf("checksum %g\n", (double) checksum);
+
+  free(matrices);
+  free(expected);
+  free(results);
+  free(points);
+}
@@ -2,106 +2,28 @@
 #include <glad/glad.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "../common/camera.h"
+#include "../common/job_pool.h"
+#include "../common/mat4.h"
+#include "../common/transform.h"
 #include "SDL_events.h"
+#include "cube_geometry.h"
+#include "instancing.h"
+#include "math_bench.h"
 
 static int is_wireframe = 0;
 
-const GLfloat cube_vertices[] = { // Positions
-    -0.5f, -0.5f, -0.5f,
-
-    0.5f,  -0.5f, -0.5f,
-
-    0.5f,  0.5f,  -0.5f,
-
-    0.5f,  0.5f,  -0.5f,
-
-    -0.5f, 0.5f,  -0.5f,
-
-    -0.5f, -0.5f, -0.5f,
-
-    -0.5f, -0.5f, 0.5f,
-
-    0.5f,  -0.5f, 0.5f,
-
-    0.5f,  0.5f,  0.5f,
-
-    0.5f,  0.5f,  0.5f,
-
-    -0.5f, 0.5f,  0.5f,
-
-    -0.5f, -0.5f, 0.5f,
-
-    -0.5f, 0.5f,  0.5f,
-
-    -0.5f, 0.5f,  -0.5f,
-
-    -0.5f, -0.5f, -0.5f,
-
-    -0.5f, -0.5f, -0.5f,
-
-    -0.5f, -0.5f, 0.5f,
-
-    -0.5f, 0.5f,  0.5f,
-
-    0.5f,  0.5f,  0.5f,
-
-    0.5f,  0.5f,  -0.5f,
-
-    0.5f,  -0.5f, -0.5f,
-
-    0.5f,  -0.5f, -0.5f,
-
-    0.5f,  -0.5f, 0.5f,
-
-    0.5f,  0.5f,  0.5f,
-
-    -0.5f, -0.5f, -0.5f,
-
-    0.5f,  -0.5f, -0.5f,
-
-    0.5f,  -0.5f, 0.5f,
-
-    0.5f,  -0.5f, 0.5f,
-
-    -0.5f, -0.5f, 0.5f,
-
-    -0.5f, -0.5f, -0.5f,
-
-    -0.5f, 0.5f,  -0.5f,
-
-    0.5f,  0.5f,  -0.5f,
-
-    0.5f,  0.5f,  0.5f,
-
-    0.5f,  0.5f,  0.5f,
-
-    -0.5f, 0.5f,  0.5f,
-
-    -0.5f, 0.5f,  -0.5f
-};
-
-const GLfloat colors[] = {
-    0.583f, 0.771f, 0.014f, 0.609f, 0.115f, 0.436f, 0.327f, 0.483f, 0.844f,
-    0.822f, 0.569f, 0.201f, 0.435f, 0.602f, 0.223f, 0.310f, 0.747f, 0.185f,
-    0.597f, 0.770f, 0.761f, 0.559f, 0.436f, 0.730f, 0.359f, 0.583f, 0.152f,
-    0.483f, 0.596f, 0.789f, 0.559f, 0.861f, 0.639f, 0.195f, 0.548f, 0.859f,
-    0.014f, 0.184f, 0.576f, 0.771f, 0.328f, 0.970f, 0.406f, 0.615f, 0.116f,
-    0.676f, 0.977f, 0.133f, 0.971f, 0.572f, 0.833f, 0.140f, 0.616f, 0.489f,
-    0.997f, 0.513f, 0.064f, 0.945f, 0.719f, 0.592f, 0.543f, 0.021f, 0.978f,
-    0.279f, 0.317f, 0.505f, 0.167f, 0.620f, 0.077f, 0.347f, 0.857f, 0.137f,
-    0.055f, 0.953f, 0.042f, 0.714f, 0.505f, 0.345f, 0.783f, 0.290f, 0.734f,
-    0.722f, 0.645f, 0.174f, 0.302f, 0.455f, 0.848f, 0.225f, 0.587f, 0.040f,
-    0.517f, 0.713f, 0.338f, 0.053f, 0.959f, 0.120f, 0.393f, 0.621f, 0.362f,
-    0.673f, 0.211f, 0.457f, 0.820f, 0.883f, 0.371f, 0.982f, 0.099f, 0.879f
-};
-
 // Vertex Shader Source Code
 const GLchar *vertex_shader_source =
     "#version 410 core\n"
 
     "layout(location = 0) in vec3 position;\n"
     "layout(location = 1) in vec3 color;\n"
+    "layout(location = 2) in mat4 instance_model;\n"
+    "layout(location = 6) in vec3 instance_color;\n"
     "out vec4 our_color;\n"
 
     "uniform mat4 model;\n"
@@ -110,8 +32,9 @@ const GLchar *vertex_shader_source =
 
     "void main()\n"
     "{\n"
-    "    gl_Position = projection * view * model * vec4(position, 1.0);\n"
-    "    our_color = vec4(color, 1.0);\n"
+    "    vec4 local = instance_model * vec4(position, 1.0);\n"
+    "    gl_Position = projection * view * model * local;\n"
+    "    our_color = vec4(color * instance_color, 1.0);\n"
     "}\n";
 
 // Fragment Shader Source Code
@@ -125,6 +48,56 @@ const GLchar *fragment_shader_source =
     "    color = our_color;\n"
     "}\n";
 
+struct options {
+  int instances;
+  enum cube_layout layout;
+  enum stream_strategy stream;
+  int bench;
+  int bench_math;
+};
+
+// scene_3d [--instances N] [--layout unindexed|aos|soa] [--stream ring|orphan]
+//          [--bench] [--bench-math]
+struct options parse_options(int argc, char **argv) {
+  struct options options = {0, CUBE_UNINDEXED, STREAM_RING, 0, 0};
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+      options.instances = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+      enum cube_layout layout = find_cube_layout(argv[++i]);
+      if (layout == CUBE_LAYOUT_COUNT)
+        printf("Unknown layout %s\n", argv[i]);
+      else
+        options.layout = layout;
+    } else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "ring") == 0)
+        options.stream = STREAM_RING;
+      else if (strcmp(argv[i], "orphan") == 0)
+        options.stream = STREAM_ORPHAN;
+      else
+        printf("Unknown stream strategy %s\n", argv[i]);
+    } else if (strcmp(argv[i], "--bench") == 0) {
+      options.bench = 1;
+    } else if (strcmp(argv[i], "--bench-math") == 0) {
+      options.bench_math = 1;
+    } else {
+      printf("Unknown argument %s\n", argv[i]);
+      printf(
+          "Usage: %s [--instances N] [--layout unindexed|aos|soa] "
+          "[--stream ring|orphan] [--bench] [--bench-math]\n",
+          argv[0]
+      );
+    }
+  }
+
+  // The benchmark is only interesting with lots of vertices
+  if (options.instances < 1)
+    options.instances = options.bench ? 100000 : 1;
+  return options;
+}
+
 void sdl_die(const char *message) {
   printf("%s: %s\n", message, SDL_GetError());
   SDL_Quit();
@@ -146,8 +119,15 @@ GLuint compile_shader(GLenum shader_type, const GLchar *source) {
   return shader;
 }
 
-void process_input(SDL_Event *event, int *running) {
+void process_input(
+    SDL_Event *event,
+    int *running,
+    struct camera *camera,
+    SDL_Window *window
+) {
   while (SDL_PollEvent(event)) {
+    camera_handle_event(camera, window, event);
+
     switch (event->type) {
       case SDL_QUIT: {
         *running = 0;
@@ -169,7 +149,11 @@ void process_input(SDL_Event *event, int *running) {
   }
 }
 
-void setup_matrix(GLuint shader_program, const char *name, float *matrix) {
+void setup_matrix(
+    GLuint shader_program,
+    const char *name,
+    const float *matrix
+) {
   GLuint location = glGetUniformLocation(shader_program, name);
   glUniformMatrix4fv(location, 1, GL_FALSE, matrix);
 }
@@ -179,51 +163,15 @@ void setup_int(GLuint shader, const char *name, int num) {
   glUniform1i(location, num);
 }
 
-void multiply_matrices(float *result, const float *mat1, const float *mat2) {
-  for (int row = 0; row < 4; ++row) {
-    for (int col = 0; col < 4; ++col) {
-      result[row * 4 + col] = 0;
-      for (int k = 0; k < 4; ++k) {
-        result[row * 4 + col] += mat1[row * 4 + k] * mat2[k * 4 + col];
-      }
-    }
-  }
-}
-
-void rotate_matrix(float *matrix, float angle, float x, float y, float z) {
-  float c = cos(angle);
-  float s = sin(angle);
-  float axis_length = sqrt(x * x + y * y + z * z);
-  x /= axis_length;
-  y /= axis_length;
-  z /= axis_length;
-
-  float rotation[16] = {
-      c + (1 - c) * x * x,
-      (1 - c) * x * y - s * z,
-      (1 - c) * x * z + s * y,
-      0.0f,
-      (1 - c) * y * x + s * z,
-      c + (1 - c) * y * y,
-      (1 - c) * y * z - s * x,
-      0.0f,
-      (1 - c) * z * x - s * y,
-      (1 - c) * z * y + s * x,
-      c + (1 - c) * z * z,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      1.0f
-  };
+int main(int argc, char **argv) {
+  struct options options = parse_options(argc, argv);
 
-  float result[16];
-  multiply_matrices(result, matrix, rotation);
-  for (int i = 0; i < 16; i++)
-    matrix[i] = result[i];
-}
+  // Only times the matrix code, no window needed
+  if (options.bench_math) {
+    benchmark_math();
+    return 0;
+  }
 
-int main(void) {
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     sdl_die("Couldn't initialize SDL");
   }
@@ -280,60 +228,27 @@ int main(void) {
   glDeleteShader(vertex_shader);
   glDeleteShader(fragment_shader);
 
-  GLuint vao, vbo;
-  glGenVertexArrays(1, &vao);
-  glGenBuffers(1, &vbo);
-
-  glBindVertexArray(vao);
-
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(
-      GL_ARRAY_BUFFER,
-      sizeof(cube_vertices),
-      cube_vertices,
-      GL_STATIC_DRAW
-  );
-
-  GLuint colorbuffer;
-  glGenBuffers(1, &colorbuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
+  // The cube (or the grid of cubes) hangs off model_node, the instances are
+  // nodes of their own under a grid node
+  struct transform_graph graph;
+  init_transform_graph(&graph);
+  uint32_t model_node = add_transform_node(&graph, TRANSFORM_NO_PARENT);
 
-  // Position attribute
-  glEnableVertexAttribArray(0);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid *) 0);
-  glEnableVertexAttribArray(0);
+  // Worker threads for the transform updates
+  struct job_pool pool;
+  init_job_pool(&pool, 0);
 
-  glEnableVertexAttribArray(1);
-  glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void *) 0);
+  // Per instance transforms & colours, `--instances N` for a stress test
+  struct cube_instances instances;
+  init_cube_instances(&instances, options.instances, options.stream, &graph);
 
-  glBindVertexArray(0);
+  struct cube_geometry geometry;
+  init_cube_geometry(&geometry, options.layout, &instances);
 
   // Load and create a texture
   glUseProgram(shader_program);
 
   // Transformation matrices
-  float model[16] = {
-      1.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      1.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      1.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      1.0f,
-  };
-
   float view[16] = {
       0.25f,
       0.0f,
@@ -353,24 +268,18 @@ int main(void) {
       0.25f
   };
 
-  float projection[16] = {
+  // The field of view the hard-coded projection had, with reverse Z if the
+  // driver supports it. The projection follows the window size from here on.
+  struct camera camera;
+  init_perspective_camera(
+      &camera,
+      window,
+      2.0f * atanf(0.75f),
       1.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      1.3333f,
-      0.0f,
-      0.0f,
-      0.0f,
-      0.0f,
-      -1.02f,
-      -1.0f,
-      0.0f,
-      0.0f,
-      -2.02f,
-      0.0f
-  };
+      101.0f,
+      1
+  );
+  const float *projection = camera.projection;
 
   /**/
 
@@ -382,8 +291,22 @@ int main(void) {
   uint32_t start = SDL_GetTicks();
   glClearColor(0.2f, 0.5f, 0.7f, 1.0f);
 
+  // Compare the cube layouts instead of running the scene
+  if (options.bench) {
+    update_transform_graph(&graph, &pool);
+    const float *model = transform_world(&graph, model_node);
+    cull_cube_instances(&instances, model, view, projection);
+    upload_cube_instances(&instances, &graph);
+    setup_matrix(shader_program, "model", model);
+    setup_matrix(shader_program, "view", view);
+    setup_matrix(shader_program, "projection", projection);
+
+    benchmark_cube_layouts(window, &instances);
+    running = 0;
+  }
+
   while (running) {
-    process_input(&event, &running);
+    process_input(&event, &running, &camera, window);
 
     // Update model matrix to rotate
     uint32_t curr = SDL_GetTicks();
@@ -395,28 +318,21 @@ int main(void) {
     if (angle > 360.0f)
       angle -= 360.0f;
 
-    // Identity matrix
-    model[0] = 0.1f;
-    model[4] = 0.0f;
-    model[8] = 0.0f;
-    model[12] = 0.0f;
-    model[1] = 0.0f;
-    model[5] = 0.1f;
-    model[9] = 0.0f;
-    model[13] = 0.0f;
-    model[2] = 0.0f;
-    model[6] = 0.0f;
-    model[10] = 0.1f;
-    model[14] = 0.0f;
-    model[3] = 0.0f;
-    model[7] = 0.0f;
-    model[11] = 0.0f;
-    model[15] = 0.1f;
-
-    // Apply rotation around Y axis
-    rotate_matrix(model, angle, 0.0f, 1.0f, 0.0f);
-
-    // Render
+    // Spin clockwise around the Y axis
+    float rotation[4];
+    quat_from_axis_angle(rotation, -angle, 0.0f, 1.0f, 0.0f);
+    set_transform_rotation(&graph, model_node, rotation);
+    update_cube_instances(&instances, &graph, angle);
+
+    // Only the nodes that moved get recomputed, only the cubes inside the
+    // frustum get uploaded
+    update_transform_graph(&graph, &pool);
+    const float *model = transform_world(&graph, model_node);
+    cull_cube_instances(&instances, model, view, projection);
+    upload_cube_instances(&instances, &graph);
+
+    // Render, into the camera's float depth target with reverse Z
+    begin_camera_frame(&camera);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     glUseProgram(shader_program);
@@ -427,19 +343,23 @@ int main(void) {
     setup_matrix(shader_program, "projection", projection);
 
     // Draw the object
-    glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
+    draw_cube_geometry(&geometry, &instances);
+    fence_stream_buffer(&instances.matrix_stream);
+    end_camera_frame(&camera);
 
     SDL_GL_SwapWindow(window);
+    report_cube_instances(&instances);
 
     SDL_Delay(1);
   }
 
   // Cleanup
-  glDeleteVertexArrays(1, &vao);
-  glDeleteBuffers(1, &vbo);
+  free_cube_geometry(&geometry);
+  free_cube_instances(&instances);
+  free_transform_graph(&graph);
+  destroy_job_pool(&pool);
   glDeleteProgram(shader_program);
+  free_camera(&camera);
 
   SDL_GL_DeleteContext(context);
   SDL_DestroyWindow(window);
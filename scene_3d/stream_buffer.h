@@ -0,0 +1,157 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <glad/glad.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Buffer for data that is rewritten every frame. The ring strategy splits one
+// buffer into STREAM_BUFFER_REGIONS regions and writes a different one each
+// frame through an unsynchronized mapping; a fence placed after the frame's
+// draws tells when the GPU is done with a region, so the CPU only waits if it
+// gets STREAM_BUFFER_REGIONS frames ahead. The orphan strategy reallocates the
+// storage every frame and leaves the synchronization to the driver, it is
+// used when asked for or when the unsynchronized mapping fails.
+//
+//   void *data = map_stream_buffer(&stream, size);
+//   ... write size bytes, then point attributes at stream.offset ...
+//   unmap_stream_buffer(&stream);
+//   ... draw ...
+//   fence_stream_buffer(&stream);
+
+#define STREAM_BUFFER_REGIONS 3
+
+enum stream_strategy {
+  STREAM_RING,
+  STREAM_ORPHAN,
+};
+
+struct stream_buffer {
+  GLenum target;
+  GLuint buffer;
+  enum stream_strategy strategy;
+
+  size_t region_size;
+  int region;                           // the one being written this frame
+  GLsync fences[STREAM_BUFFER_REGIONS]; // 0 if the region is free
+  size_t offset; // where this frame's data starts in the buffer
+
+  // How often the CPU had to wait for the GPU and for how long
+  unsigned int stalls;
+  uint64_t stall_ticks;
+};
+
+void init_stream_buffer(
+    struct stream_buffer *stream,
+    GLenum target,
+    size_t region_size,
+    enum stream_strategy strategy
+) {
+  memset(stream, 0, sizeof(*stream));
+  stream->target = target;
+  stream->region_size = region_size;
+  stream->strategy = strategy;
+
+  size_t size = strategy == STREAM_RING ? region_size * STREAM_BUFFER_REGIONS
+                                        : region_size;
+  glGenBuffers(1, &stream->buffer);
+  glBindBuffer(target, stream->buffer);
+  glBufferData(target, size, NULL, GL_STREAM_DRAW);
+  glBindBuffer(target, 0);
+}
+
+// Blocks until the GPU released the region that is about to be written
+static void stream_wait_region(struct stream_buffer *stream) {
+  GLsync fence = stream->fences[stream->region];
+  if (!fence)
+    return;
+
+  GLenum result = glClientWaitSync(fence, 0, 0);
+  if (result == GL_TIMEOUT_EXPIRED) {
+    uint64_t start = SDL_GetPerformanceCounter();
+    stream->stalls++;
+
+    do {
+      result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    } while (result == GL_TIMEOUT_EXPIRED);
+
+    stream->stall_ticks += SDL_GetPerformanceCounter() - start;
+  }
+
+  glDeleteSync(fence);
+  stream->fences[stream->region] = 0;
+}
+
+static void stream_fall_back_to_orphaning(struct stream_buffer *stream) {
+  printf("Unsynchronized mapping failed, orphaning the stream buffer\n");
+
+  for (int i = 0; i < STREAM_BUFFER_REGIONS; i++) {
+    if (stream->fences[i])
+      glDeleteSync(stream->fences[i]);
+    stream->fences[i] = 0;
+  }
+  stream->strategy = STREAM_ORPHAN;
+  stream->region = 0;
+}
+
+// Maps `size` bytes (at most region_size) for writing, the data ends up at
+// stream->offset in the buffer. Returns NULL if the buffer can't be mapped.
+void *map_stream_buffer(struct stream_buffer *stream, size_t size) {
+  if (size > stream->region_size)
+    size = stream->region_size;
+
+  glBindBuffer(stream->target, stream->buffer);
+
+  if (stream->strategy == STREAM_RING) {
+    stream_wait_region(stream);
+    stream->offset = stream->region * stream->region_size;
+
+    void *data = glMapBufferRange(
+        stream->target,
+        stream->offset,
+        size,
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+            | GL_MAP_INVALIDATE_RANGE_BIT
+    );
+    if (data)
+      return data;
+
+    stream_fall_back_to_orphaning(stream);
+  }
+
+  // Fresh storage, whatever the GPU still reads stays in the old one
+  glBufferData(stream->target, stream->region_size, NULL, GL_STREAM_DRAW);
+  stream->offset = 0;
+  return glMapBufferRange(
+      stream->target,
+      0,
+      size,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
+  );
+}
+
+void unmap_stream_buffer(struct stream_buffer *stream) {
+  glBindBuffer(stream->target, stream->buffer);
+  glUnmapBuffer(stream->target);
+  glBindBuffer(stream->target, 0);
+}
+
+// Call after the last draw that reads this frame's data
+void fence_stream_buffer(struct stream_buffer *stream) {
+  if (stream->strategy != STREAM_RING)
+    return;
+
+  stream->fences[stream->region] =
+      glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  stream->region = (stream->region + 1) % STREAM_BUFFER_REGIONS;
+}
+
+void free_stream_buffer(struct stream_buffer *stream) {
+  for (int i = 0; i < STREAM_BUFFER_REGIONS; i++) {
+    if (stream->fences[i])
+      glDeleteSync(stream->fences[i]);
+  }
+  glDeleteBuffers(1, &stream->buffer);
+  memset(stream, 0, sizeof(*stream));
+}